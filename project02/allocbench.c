@@ -0,0 +1,47 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define HEAPSIZE (1024*1024)  // heap grown and touched per round
+#define NROUND 50
+#define MAXWORKERS 8
+
+// Stress the page allocator from many cpus at once: each worker
+// grows, touches and shrinks its heap, and forks a child that
+// exits at once.  Every worker does the same work, so with enough
+// cpus the time should stay flat as workers are added.
+// Run with CPUS=1 .. CPUS=8 to see how it scales.
+// Usage: allocbench [max workers]
+int main(int argc, char *argv[])
+{
+  char *heap;
+  int n, max, i, j, r, start;
+
+  max = argc > 1 ? atoi(argv[1]) : MAXWORKERS;
+  for (n = 1; n <= max; n++) {
+    start = uptime();
+    for (i = 0; i < n; i++) {
+      if (fork() == 0) {
+        for (r = 0; r < NROUND; r++) {
+          if ((heap = sbrk(HEAPSIZE)) == (char *)-1) {
+            printf(1, "sbrk failed\n");
+            exit();
+          }
+          for (j = 0; j < HEAPSIZE; j += 4096)
+            heap[j] = j;
+          sbrk(-HEAPSIZE);
+          if (fork() == 0)
+            exit();
+          wait();
+        }
+        exit();
+      }
+    }
+    for (i = 0; i < n; i++)
+      wait();
+    printf(1, "%d workers: %d ticks for %d rounds each\n",
+           n, uptime() - start, NROUND);
+  }
+  procdump2();
+  exit();
+}
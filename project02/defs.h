@@ -7,8 +7,10 @@ struct proc;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
+struct slabcache;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
 void binit(void);
@@ -25,6 +27,7 @@ void panic(char*) __attribute__((noreturn));
 // exec.c
 int exec(char*, char**);
 int exec2(char*, char**, int);
+int execimage(struct proc*, char*, char**, int, pde_t**, struct inode**);
 
 // file.c
 struct file* filealloc(void);
@@ -56,8 +59,9 @@ int writei(struct inode*, char*, uint, uint);
 
 // ide.c
 void ideinit(void);
-void ideintr(void);
+void ideintr(int);
 void iderw(struct buf*);
+int idepresent(int);
 
 // ioapic.c
 void ioapicenable(int irq, int cpu);
@@ -69,6 +73,16 @@ char* kalloc(void);
 void kfree(char*);
 void kinit1(void*, void*);
 void kinit2(void*, void*);
+void kincref(char*);
+int kgetref(char*);
+char* kallocbig(void);
+void kfreebig(char*);
+char* kalloc_order(int);
+void kfree_order(char*, int);
+int kfreecount(void);
+char* kalloc_zeroed(void);
+void kzeroidle(void);
+void kallocstat(void);
 
 // kbd.c
 void kbdintr(void);
@@ -80,6 +94,7 @@ extern volatile uint* lapic;
 void lapiceoi(void);
 void lapicinit(void);
 void lapicstartap(uchar, uint);
+void lapicipi(int, int);
 void microdelay(int);
 
 // log.c
@@ -97,6 +112,7 @@ void picenable(int);
 void picinit(void);
 
 // pipe.c
+void pipeinit(void);
 int pipealloc(struct file**, struct file**);
 void pipeclose(struct pipe*, int);
 int piperead(struct pipe*, char*, int);
@@ -107,6 +123,12 @@ int pipewrite(struct pipe*, char*, int);
 int cpuid(void);
 void exit(void);
 int fork(void);
+int spawn(char*, char**, int*);
+int mmap(uint, int, int);
+int munmap(uint, uint);
+void memcharge(struct proc*, int);
+int memcheck(struct proc*, int);
+int swapscan(char**, uint*, int);
 int growproc(int);
 int kill(int);
 struct cpu* mycpu(void);
@@ -129,6 +151,23 @@ int thread_join(thread_t, void**);
 void thread_clear1(void);
 void thread_clear(void);
 
+// slab.c
+struct slabcache* slabcreate(char*, uint, void (*)(void*));
+void* slaballoc(struct slabcache*);
+void slabfree(struct slabcache*, void*);
+void slabstat(void);
+
+// swap.c
+void swapinit(void);
+void swaplock(void);
+void swapunlock(void);
+void swapread(char*, uint);
+int swapalloc(void);
+void swapdup(uint);
+void swapfree(uint);
+char* ualloc(int);
+void swapstat(void);
+
 // swtch.S
 void swtch(struct context**, struct context*);
 
@@ -159,6 +198,7 @@ char* strncpy(char*, const char*, int);
 // syscall.c
 int argint(int, int*);
 int argptr(int, char**, int);
+int argwritable(char*, int);
 int argstr(int, char**);
 int fetchint(uint, int*);
 int fetchstr(uint, char**);
@@ -187,12 +227,27 @@ int allocuvm(pde_t*, uint, uint);
 int deallocuvm(pde_t*, uint, uint);
 void freevm(pde_t*);
 void inituvm(pde_t*, char*, uint);
-int loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t* copyuvm(pde_t*, uint);
+pde_t* copyuvm(pde_t*, uint, struct vma*);
 void switchuvm(struct proc*);
 void switchkvm(void);
 int copyout(pde_t*, uint, void*, uint);
 void clearpteu(pde_t* pgdir, char* uva);
+int settls(struct proc*, uint);
+void tlbintr(void);
+void tlbserve(void);
+int cowfault(pde_t*, uint);
+int cowbreak(pde_t*, uint, uint);
+int lazyfault(struct proc*, uint);
+struct vma* findvma(struct proc*, uint);
+uint uvmend(struct proc*, uint);
+int mapzero(pde_t*, uint, uint, int);
+int upages(pde_t*, uint, uint);
+int ptpages(pde_t*);
+void pcinval(struct inode*);
+void pcstat(void);
+void bigpgstat(void);
+void tlbstat(void);
+int clockscan(struct proc*, uint*, char**, uint*, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x) / sizeof((x)[0]))
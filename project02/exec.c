@@ -7,17 +7,60 @@
 #include "x86.h"
 #include "elf.h"
 
+// Record the loadable segments of the ELF file ip in seg.  Pages
+// are read on first touch by lazyfault() in vm.c, and read-only
+// ones are shared with other processes running the same file.
+// Returns the end of the program image, or 0 if it is bad.
+static uint
+readsegs(struct inode *ip, struct elfhdr *elf, struct execseg *seg, int *nseg)
+{
+  int i, off;
+  uint sz;
+  struct proghdr ph;
+
+  sz = 0;
+  *nseg = 0;
+  for(i=0, off=elf->phoff; i<elf->phnum; i++, off+=sizeof(ph)){
+    if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
+      return 0;
+    if(ph.type != ELF_PROG_LOAD)
+      continue;
+    if(ph.memsz < ph.filesz)
+      return 0;
+    if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz > MMAPBASE)
+      return 0;
+    if(ph.off + ph.filesz < ph.off)
+      return 0;
+    if(*nseg == NPROGSEG)
+      return 0;
+    seg[*nseg].va = ph.vaddr;
+    seg[*nseg].memsz = ph.memsz;
+    seg[*nseg].off = ph.off;
+    seg[*nseg].filesz = ph.filesz;
+    seg[*nseg].writable = (ph.flags & ELF_PROG_FLAG_WRITE) != 0;
+    (*nseg)++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
+  }
+  return sz;
+}
+
+// Build the image of program path with arguments argv and
+// stacksize stack pages in a new page table, and install it in p.
+// p runs the new image on its next return to user space.  The
+// old page table and program file of p are handed back in
+// *oldpgdir and *oldexe for the caller to release.
 int
-exec(char *path, char **argv)
+execimage(struct proc *p, char *path, char **argv, int stacksize,
+          pde_t **oldpgdir, struct inode **oldexe)
 {
   char *s, *last;
-  int i, off;
-  uint argc, sz, sp, ustack[3+MAXARG+1];
+  int nseg;
+  uint argc, sz, sp, tls, ustack[3+MAXARG+1];
   struct elfhdr elf;
-  struct inode *ip;
-  struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
+  struct inode *ip, *exe;
+  struct execseg seg[NPROGSEG];
+  pde_t *pgdir;
 
   begin_op();
 
@@ -28,6 +71,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  exe = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -38,41 +82,33 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
-  sz = 0;
-  for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
-    if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
-      goto bad;
-    if(ph.type != ELF_PROG_LOAD)
-      continue;
-    if(ph.memsz < ph.filesz)
-      goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
-      goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
-    if(ph.vaddr % PGSIZE != 0)
-      goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
-      goto bad;
-  }
+  // Record the program segments.  Nothing is loaded yet.
+  if((sz = readsegs(ip, &elf, seg, &nseg)) == 0)
+    goto bad;
+  exe = idup(ip);
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  // Allocate two pages at the next page boundary.
-  // Make the first inaccessible.  Use the second as the user stack.
+  // Allocate stacksize+1 pages at the next page boundary.
+  // Make the first inaccessible.  Use the rest as the user stack.
   sz = PGROUNDUP(sz);
-  if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE)) == 0)
+  if((sz = allocuvm(pgdir, sz, sz + (1 + stacksize)*PGSIZE)) == 0)
     goto bad;
-  clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
+  clearpteu(pgdir, (char*)(sz - (1 + stacksize)*PGSIZE));
   sp = sz;
 
-  // Check the memory limit
-  if(curproc->limit !=0 && sz > curproc->limit)
+  // Check the memory limit against the pages the new image
+  // starts with.  The rest are checked as they are touched.
+  if(p->limit !=0 && (1 + stacksize + ptpages(pgdir))*PGSIZE > p->limit)
     goto bad;
 
-  curproc->spnum = 1;
+  // Reserve the thread-local storage block at the top of the
+  // stack, above the arguments, so the stack never grows into it.
+  tls = sz - TLSSIZE;
+  if(copyout(pgdir, tls, &tls, sizeof(tls)) < 0)
+    goto bad;
+  sp = tls;
 
   // Push argument strings, prepare rest of stack in ustack.
   for(argc = 0; argv[argc]; argc++) {
@@ -97,20 +133,24 @@ exec(char *path, char **argv)
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  safestrcpy(p->name, last, sizeof(p->name));
 
   // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  switchuvm(curproc);
-  freevm(oldpgdir);
-
-  // Clean up all other threads.
-  thread_clear();
-
+  *oldpgdir = p->pgdir;
+  *oldexe = p->exe;
+  p->pgdir = pgdir;
+  p->sz = sz;
+  p->rss = 1 + stacksize;
+  p->spnum = stacksize;
+  p->tf->eip = elf.entry;  // main
+  p->tf->esp = sp;
+  p->tf->gs = (SEG_UTLS << 3) | DPL_USER;
+  p->tls = tls;
+  p->exe = exe;
+  p->nseg = nseg;
+  memmove(p->seg, seg, sizeof(seg));
+  // mmap() regions go away with the old page table.
+  memset(p->vma, 0, sizeof(p->vma));
   return 0;
 
  bad:
@@ -120,121 +160,39 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
 
+int
+exec(char *path, char **argv)
+{
+  return exec2(path, argv, 1);
+}
+
 int
 exec2(char *path, char **argv, int stacksize)
 {
-  char *s, *last;
-  int i, off;
-  uint argc, sz, sp, ustack[3+MAXARG+1];
-  struct elfhdr elf;
-  struct inode *ip;
-  struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
+  pde_t *oldpgdir;
+  struct inode *oldexe;
   struct proc *curproc = myproc();
 
-  begin_op();
-
-  if((ip = namei(path)) == 0){
-    end_op();
-    cprintf("exec: fail\n");
+  if(execimage(curproc, path, argv, stacksize, &oldpgdir, &oldexe) < 0)
     return -1;
-  }
-  ilock(ip);
-  pgdir = 0;
-
-  // Check ELF header
-  if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
-    goto bad;
-  if(elf.magic != ELF_MAGIC)
-    goto bad;
-
-  if((pgdir = setupkvm()) == 0)
-    goto bad;
-
-  // Load program into memory.
-  sz = 0;
-  for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
-    if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
-      goto bad;
-    if(ph.type != ELF_PROG_LOAD)
-      continue;
-    if(ph.memsz < ph.filesz)
-      goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
-      goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
-    if(ph.vaddr % PGSIZE != 0)
-      goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
-      goto bad;
-  }
-  iunlockput(ip);
-  end_op();
-  ip = 0;
-
-  // Allocate two pages at the next page boundary.
-  // Make the first inaccessible.  Use the second as the user stack.
-  sz = PGROUNDUP(sz);
-  if((sz = allocuvm(pgdir, sz, sz + (1 + stacksize)*PGSIZE)) == 0)
-    goto bad;
-  clearpteu(pgdir, (char*)(sz - (1 + stacksize)*PGSIZE));
-  sp = sz;
-
-  // Check the memory limit
-  if(curproc->limit !=0 && sz > curproc->limit)
-    goto bad;
-  
-  curproc->spnum = stacksize;
-
-  // Push argument strings, prepare rest of stack in ustack.
-  for(argc = 0; argv[argc]; argc++) {
-    if(argc >= MAXARG)
-      goto bad;
-    sp = (sp - (strlen(argv[argc]) + 1)) & ~3;
-    if(copyout(pgdir, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
-      goto bad;
-    ustack[3+argc] = sp;
-  }
-  ustack[3+argc] = 0;
-
-  ustack[0] = 0xffffffff;  // fake return PC
-  ustack[1] = argc;
-  ustack[2] = sp - (argc+1)*4;  // argv pointer
-
-  sp -= (3+argc+1) * 4;
-  if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
-    goto bad;
-
-  // Save program name for debugging.
-  for(last=s=path; *s; s++)
-    if(*s == '/')
-      last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
-
-  // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
   switchuvm(curproc);
   freevm(oldpgdir);
 
   // Clean up all other threads.
   thread_clear();
 
-  return 0;
-
- bad:
-  if(pgdir)
-    freevm(pgdir);
-  if(ip){
-    iunlockput(ip);
+  if(oldexe){
+    begin_op();
+    iput(oldexe);
     end_op();
   }
-  return -1;
+  return 0;
 }
@@ -0,0 +1,31 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NRUN 200
+
+// Measure how many programs per second fork()+exec() can start.
+// Run it twice: the second run finds the program text in the
+// kernel's page cache.
+int main(int argc, char *argv[])
+{
+  char *args[] = { "execbench", "child", 0 };
+  int i, start, end;
+
+  if (argc > 1 && strcmp(argv[1], "child") == 0)
+    exit();
+
+  start = uptime();
+  for (i = 0; i < NRUN; i++) {
+    if (fork() == 0) {
+      exec(args[0], args);
+      printf(1, "exec failed\n");
+      exit();
+    }
+    wait();
+  }
+  end = uptime();
+
+  printf(1, "%d execs in %d ticks\n", NRUN, end - start);
+  exit();
+}
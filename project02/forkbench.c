@@ -0,0 +1,40 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define HEAPSIZE (64*1024*1024)  // size of the parent's heap
+#define NRUN 20
+
+// Measure fork()+exec() latency of a process with a large heap.
+int main(int argc, char *argv[])
+{
+  char *args[] = { "forkbench", "child", 0 };
+  char *heap;
+  int i, start, end;
+
+  if (argc > 1 && strcmp(argv[1], "child") == 0)
+    exit();
+
+  heap = sbrk(HEAPSIZE);
+  if (heap == (char *)-1) {
+    printf(1, "sbrk failed\n");
+    exit();
+  }
+  for (i = 0; i < HEAPSIZE; i += 4096)
+    heap[i] = i;
+
+  start = uptime();
+  for (i = 0; i < NRUN; i++) {
+    if (fork() == 0) {
+      exec(args[0], args);
+      printf(1, "exec failed\n");
+      exit();
+    }
+    wait();
+  }
+  end = uptime();
+
+  printf(1, "fork+exec of a %d MB process: %d ticks for %d runs\n",
+         HEAPSIZE / (1024*1024), end - start, NRUN);
+  exit();
+}
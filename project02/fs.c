@@ -155,28 +155,39 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// entries. Since ip->ref indicates whether an entry is in use,
+// and ip->dev, ip->inum and ip->next place an entry in the hash
+// table, one must hold icache.lock while using any of those fields.
+// Entries come from a slab cache and go back to it when their
+// last reference is dropped, so the number of active i-nodes
+// is bounded only by memory.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61  // buckets of the i-node hash table
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct slabcache *cache;
+  struct inode *hash[NIHASH];  // Active i-nodes by dev and inum
 } icache;
 
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
+// Prepare an i-node when its slab is made.
+static void
+ictor(void *v)
+{
+  initsleeplock(&((struct inode*)v)->lock, "inode");
+}
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = slabcreate("inode", sizeof(struct inode), ictor);
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
@@ -241,31 +252,31 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  uint h;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  h = IHASH(dev, inum);
+  for(ip = icache.hash[h]; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Allocate an inode cache entry.
+  if((ip = slaballoc(icache.cache)) == 0)
     panic("iget: no inodes");
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->next = icache.hash[h];
+  icache.hash[h] = ip;
   release(&icache.lock);
 
   return ip;
@@ -322,8 +333,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry is
+// freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -331,6 +342,8 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct inode **pp;
+
   acquiresleep(&ip->lock);
   if(ip->valid && ip->nlink == 0){
     acquire(&icache.lock);
@@ -347,7 +360,14 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    // Nobody can find it any more; free the cache entry.
+    pp = &icache.hash[IHASH(ip->dev, ip->inum)];
+    while(*pp != ip)
+      pp = &(*pp)->next;
+    *pp = ip->next;
+    slabfree(icache.cache, ip);
+  }
   release(&icache.lock);
 }
 
@@ -432,6 +452,7 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  pcinval(ip);
 }
 
 // Copy stat information from inode.
@@ -495,6 +516,10 @@ writei(struct inode *ip, char *src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  // Running programs must not see the new contents.
+  if(n > 0)
+    pcinval(ip);
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
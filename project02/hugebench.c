@@ -0,0 +1,53 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "mman.h"
+
+#define REGION (32*1024*1024)
+#define NACCESS (4*1024*1024)
+
+uint seed = 1;
+
+uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed;
+}
+
+// Touch every page, then time NACCESS reads and writes at random
+// places of a REGION-byte mapping made with flags.  With 4 KB pages
+// the region needs 8192 TLB entries; with 4 MB pages it needs 8.
+int
+run(char *name, int flags)
+{
+  char *p;
+  int i, start, ticks;
+
+  p = mmap(0, REGION, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|flags, -1, 0);
+  if (p == (char*)-1) {
+    printf(1, "mmap failed\n");
+    exit();
+  }
+  for (i = 0; i < REGION; i += 4096)
+    p[i] = 1;
+
+  seed = 1;
+  start = uptime();
+  for (i = 0; i < NACCESS; i++)
+    p[rand() % REGION]++;
+  ticks = uptime() - start;
+
+  printf(1, "%s: %d random accesses in %d ticks\n", name, NACCESS, ticks);
+  munmap(p, REGION);
+  return ticks;
+}
+
+int
+main(int argc, char *argv[])
+{
+  run("4KB pages", 0);
+  run("4MB pages", MAP_HUGETLB);
+  procdump2();
+  exit();
+}
@@ -24,23 +24,34 @@
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+// The primary channel holds disk 0 (the boot disk) and disk 1
+// (the file system); the secondary channel holds disk 2, the
+// swap disk.  Disk n is on channel n/2, as master if n is even.
+// Each channel serves one request at a time: its queue points
+// to the buf now being read/written to the disk, and
+// queue->qnext points to the next buf to be processed.
+// You must hold idelock while manipulating a queue.
+static struct idechan {
+  ushort base;                 // Command block registers
+  ushort ctl;                  // Device control register
+  struct buf *queue;
+} idechan[2] = {
+  { 0x1f0, 0x3f6 },
+  { 0x170, 0x376 },
+};
 
 static struct spinlock idelock;
-static struct buf *idequeue;
 
-static int havedisk1;
+static int havedisk[3];
 static void idestart(struct buf*);
 
-// Wait for IDE disk to become ready.
+// Wait for the selected disk of channel c to become ready.
 static int
-idewait(int checkerr)
+idewait(struct idechan *c, int checkerr)
 {
   int r;
 
-  while(((r = inb(0x1f7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+  while(((r = inb(c->base+7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
     ;
   if(checkerr && (r & (IDE_DF|IDE_ERR)) != 0)
     return -1;
@@ -54,29 +65,52 @@ ideinit(void)
 
   initlock(&idelock, "ide");
   ioapicenable(IRQ_IDE, ncpu - 1);
-  idewait(0);
+  idewait(&idechan[0], 0);
+  havedisk[0] = 1;
 
   // Check if disk 1 is present
   outb(0x1f6, 0xe0 | (1<<4));
   for(i=0; i<1000; i++){
     if(inb(0x1f7) != 0){
-      havedisk1 = 1;
+      havedisk[1] = 1;
       break;
     }
   }
 
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  // Check if disk 2 is present.  A channel with no disks
+  // reads as 0.
+  outb(0x176, 0xe0 | (0<<4));
+  for(i=0; i<1000; i++){
+    if(inb(0x177) != 0){
+      havedisk[2] = 1;
+      break;
+    }
+  }
+  if(havedisk[2])
+    ioapicenable(IRQ_IDE+1, ncpu - 1);
+}
+
+// Return whether disk dev is present.
+int
+idepresent(int dev)
+{
+  return dev >= 0 && dev < NELEM(havedisk) && havedisk[dev];
 }
 
 // Start the request for b.  Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct idechan *c;
+
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+  if(b->blockno >= (b->dev == SWAPDEV ? SWAPSIZE : FSSIZE))
     panic("incorrect blockno");
+  c = &idechan[b->dev/2];
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
   int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
@@ -84,39 +118,40 @@ idestart(struct buf *b)
 
   if (sector_per_block > 7) panic("idestart");
 
-  idewait(0);
-  outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
-  outb(0x1f3, sector & 0xff);
-  outb(0x1f4, (sector >> 8) & 0xff);
-  outb(0x1f5, (sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
+  idewait(c, 0);
+  outb(c->ctl, 0);  // generate interrupt
+  outb(c->base+2, sector_per_block);  // number of sectors
+  outb(c->base+3, sector & 0xff);
+  outb(c->base+4, (sector >> 8) & 0xff);
+  outb(c->base+5, (sector >> 16) & 0xff);
+  outb(c->base+6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    outb(c->base+7, write_cmd);
+    outsl(c->base, b->data, BSIZE/4);
   } else {
-    outb(0x1f7, read_cmd);
+    outb(c->base+7, read_cmd);
   }
 }
 
-// Interrupt handler.
+// Interrupt handler for channel n.
 void
-ideintr(void)
+ideintr(int n)
 {
+  struct idechan *c = &idechan[n];
   struct buf *b;
 
   // First queued buffer is the active request.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if((b = c->queue) == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
+  c->queue = b->qnext;
 
   // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(!(b->flags & B_DIRTY) && idewait(c, 1) >= 0)
+    insl(c->base, b->data, BSIZE/4);
 
   // Wake process waiting for this buf.
   b->flags |= B_VALID;
@@ -124,8 +159,8 @@ ideintr(void)
   wakeup(b);
 
   // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  if(c->queue != 0)
+    idestart(c->queue);
 
   release(&idelock);
 }
@@ -137,25 +172,27 @@ ideintr(void)
 void
 iderw(struct buf *b)
 {
+  struct idechan *c;
   struct buf **pp;
 
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
     panic("iderw: nothing to do");
-  if(b->dev != 0 && !havedisk1)
-    panic("iderw: ide disk 1 not present");
+  if(!idepresent(b->dev))
+    panic("iderw: ide disk not present");
+  c = &idechan[b->dev/2];
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
+  // Append b to its channel's queue.
   b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+  for(pp=&c->queue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
     ;
   *pp = b;
 
   // Start disk if necessary.
-  if(idequeue == b)
+  if(c->queue == b)
     idestart(b);
 
   // Wait for request to finish.
@@ -1,13 +1,29 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers.  Free memory is kept by a buddy allocator
+// in blocks of 2^k pages, aligned to their size, for k up to
+// MAXORDER (a 4 MB page).  A freed block is merged with its
+// buddy, the other half of the block twice its size, whenever
+// the buddy is free too.  Idle cpus zero free pages ahead of
+// time for kalloc_zeroed().  Each cpu keeps a magazine of free
+// pages, so that most kalloc() and kfree() calls take no shared
+// lock; it is refilled from and drained to the buddy lists in
+// batches.  A cpu that finds both empty takes another cpu's
+// magazine before it gives up.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
+#include "x86.h"
+
+#define MAXORDER     10  // largest block: 2^10 pages, a 4 MB page
+#define NZEROPAGES 4096  // free pages kept zeroed
+#define NMAG         64  // most free pages in a cpu's magazine
+#define MAGBATCH     32  // pages moved to or from a magazine at once
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -15,12 +31,25 @@ extern char end[]; // first address after kernel loaded from ELF file
 
 struct run {
   struct run *next;
+  struct run *prev;            // Only on the buddy lists
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *free[MAXORDER+1];  // Free blocks of each order
+  int nblocks[MAXORDER+1];     // Blocks on each of those lists
+  uchar order[PHYSTOP/PGSIZE]; // 1 + order of the free block at each
+                               // page, 0 if no free block starts there
+  struct run *zerolist;        // Free pages holding zeros
+  ushort ref[PHYSTOP/PGSIZE];  // References to each physical page
+  int nfreepages;              // Pages on the lists in all
+  int nzero;                   // Pages on zerolist
+  uint zhits;                  // kalloc_zeroed() calls served by zerolist
+  uint zmisses;                // and those that had to zero the page
+  uint refills;                // Batches moved to magazines
+  uint drains;                 // and back
+  uint steals;                 // Magazines taken from other cpus
 } kmem;
 
 // Initialization happens in two phases.
@@ -51,6 +80,132 @@ freerange(void *vstart, void *vend)
   for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
     kfree(p);
 }
+
+// The buddy lists.  Callers hold kmem.lock.
+
+// Put the block of order k at r on its free list.
+static void
+bpush(struct run *r, int k)
+{
+  r->prev = 0;
+  r->next = kmem.free[k];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[k] = r;
+  kmem.order[V2P(r)/PGSIZE] = k + 1;
+  kmem.nblocks[k]++;
+}
+
+// Take the block of order k at r off its free list.
+static void
+bunlink(struct run *r, int k)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[k] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.order[V2P(r)/PGSIZE] = 0;
+  kmem.nblocks[k]--;
+}
+
+// Free the block of 2^k pages at v, merged with its buddy
+// for as long as the buddy is free as a whole.
+static void
+bfree(char *v, int k)
+{
+  uint pn, bn;
+
+  kmem.nfreepages += 1 << k;
+  pn = V2P(v)/PGSIZE;
+  for(; k < MAXORDER; k++){
+    bn = pn ^ (1 << k);
+    if(bn >= PHYSTOP/PGSIZE || kmem.order[bn] != k + 1)
+      break;
+    bunlink((struct run*)P2V(bn*PGSIZE), k);
+    pn &= ~(1 << k);
+  }
+  bpush((struct run*)P2V(pn*PGSIZE), k);
+}
+
+// Allocate a block of 2^k pages, splitting a bigger block
+// if there is none that size.  Returns 0 if memory is short.
+static char*
+balloc(int k)
+{
+  struct run *r;
+  int j;
+
+  for(j = k; j <= MAXORDER && kmem.free[j] == 0; j++)
+    ;
+  if(j > MAXORDER)
+    return 0;
+  r = kmem.free[j];
+  bunlink(r, j);
+  // Keep the lower half, free the upper.
+  while(j > k){
+    j--;
+    bpush((struct run*)((char*)r + (PGSIZE << j)), j);
+  }
+  kmem.nfreepages -= 1 << k;
+  return (char*)r;
+}
+
+// Return the zeroed pages to the buddy lists, so they
+// can merge again.
+static void
+zeroflush(void)
+{
+  struct run *r;
+
+  while((r = kmem.zerolist) != 0){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+    kmem.nfreepages--;
+    bfree((char*)r, 0);
+  }
+}
+
+// Lock c's magazine.  Only a cpu taking it in magsteal()
+// ever competes with the owner, and only for a moment.
+static void
+maglock(struct cpu *c)
+{
+  while(xchg(&c->magbusy, 1) != 0)
+    ;
+}
+
+static void
+magunlock(struct cpu *c)
+{
+  xchg(&c->magbusy, 0);
+}
+
+// The buddy lists are empty: move another cpu's magazine to
+// c's, which is empty too.  Caller holds c's magazine lock, so
+// a busy magazine is skipped rather than waited for; its owner
+// may be trying to take c's.
+static void
+magsteal(struct cpu *c)
+{
+  struct cpu *o;
+
+  for(o = cpus; o < cpus+ncpu; o++){
+    if(o == c || o->mag == 0 || xchg(&o->magbusy, 1) != 0)
+      continue;
+    c->mag = o->mag;
+    c->nmag = o->nmag;
+    o->mag = 0;
+    o->nmag = 0;
+    magunlock(o);
+    if(c->mag){
+      kmem.steals++;
+      return;
+    }
+  }
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -60,37 +215,316 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct cpu *c;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  // Only the last reference really frees the page.  Nobody
+  // else can change the count of a page with one reference,
+  // so only shared pages need the lock.
+  if(kmem.ref[V2P(v)/PGSIZE] > 1){
+    if(kmem.use_lock)
+      acquire(&kmem.lock);
+    if(kmem.ref[V2P(v)/PGSIZE] > 1){
+      kmem.ref[V2P(v)/PGSIZE]--;
+      if(kmem.use_lock)
+        release(&kmem.lock);
+      return;
+    }
+    if(kmem.use_lock)
+      release(&kmem.lock);
+  }
+  kmem.ref[V2P(v)/PGSIZE] = 0;
+
+#ifdef KJUNK
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
+  if(!kmem.use_lock){
+    bfree(v, 0);
+    return;
+  }
+
+  pushcli();
+  c = mycpu();
+  maglock(c);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  r->next = c->mag;
+  c->mag = r;
+  if(++c->nmag > NMAG){
+    // Give a batch back.
+    acquire(&kmem.lock);
+    while(c->nmag > NMAG - MAGBATCH){
+      r = c->mag;
+      c->mag = r->next;
+      c->nmag--;
+      bfree((char*)r, 0);
+    }
+    kmem.drains++;
     release(&kmem.lock);
+  }
+  magunlock(c);
+  popcli();
+}
+
+// Take the first page off the zeroed list.
+// Caller must hold kmem.lock.
+static struct run*
+takezero(void)
+{
+  struct run *r;
+
+  r = kmem.zerolist;
+  if(r){
+    kmem.zerolist = r->next;
+    kmem.ref[V2P(r)/PGSIZE] = 1;
+    kmem.nfreepages--;
+    kmem.nzero--;
+  }
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// Zeroed pages are left for kalloc_zeroed() while
+// there are others.
 char*
 kalloc(void)
 {
   struct run *r;
+  struct cpu *c;
+  char *v;
+  int i;
 
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    if((v = balloc(0)) == 0)
+      v = (char*)takezero();
+    else
+      kmem.ref[V2P(v)/PGSIZE] = 1;
+    return v;
+  }
+
+  pushcli();
+  c = mycpu();
+  maglock(c);
+  if(c->mag == 0){
     acquire(&kmem.lock);
-  r = kmem.freelist;
+    for(i = 0; i < MAGBATCH && (v = balloc(0)) != 0; i++){
+      r = (struct run*)v;
+      r->next = c->mag;
+      c->mag = r;
+      c->nmag++;
+    }
+    if(i > 0)
+      kmem.refills++;
+    release(&kmem.lock);
+  }
+  if(c->mag == 0)
+    magsteal(c);
+  if((r = c->mag) != 0){
+    c->mag = r->next;
+    c->nmag--;
+    kmem.ref[V2P(r)/PGSIZE] = 1;
+  }
+  magunlock(c);
+  popcli();
   if(r)
-    kmem.freelist = r->next;
+    return (char*)r;
+
+  acquire(&kmem.lock);
+  r = takezero();
+  release(&kmem.lock);
+  return (char*)r;
+}
+
+// Allocate one 4096-byte page of physical memory filled
+// with zeros.  Returns 0 if the memory cannot be allocated.
+char*
+kalloc_zeroed(void)
+{
+  struct run *r;
+  char *v;
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if((r = takezero()) != 0)
+    kmem.zhits++;
+  else
+    kmem.zmisses++;
   if(kmem.use_lock)
     release(&kmem.lock);
-  return (char*)r;
+
+  if(r){
+    r->next = 0;  // The only word that is not zero.
+    return (char*)r;
+  }
+  if((v = kalloc()) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Zero one free page for kalloc_zeroed(), unless NZEROPAGES are
+// ready already.  The scheduler calls this when it finds nothing
+// to run, so the zeroing is done by cpus that are idle anyway.
+void
+kzeroidle(void)
+{
+  char *v;
+  struct run *r;
+
+  if(!kmem.use_lock || kmem.nzero >= NZEROPAGES || kmem.nfreepages == 0)
+    return;
+
+  // While it is being zeroed, the page is on no list
+  // and counts as allocated.
+  acquire(&kmem.lock);
+  v = balloc(0);
+  release(&kmem.lock);
+  if(v == 0)
+    return;
+
+  memset(v, 0, PGSIZE);
+
+  acquire(&kmem.lock);
+  r = (struct run*)v;
+  r->next = kmem.zerolist;
+  kmem.zerolist = r;
+  kmem.nzero++;
+  kmem.nfreepages++;
+  release(&kmem.lock);
+}
+
+// Allocate 2^n physically contiguous pages, aligned to their
+// size.  Returns 0 if there is no free block that big.  The
+// block has one reference, kept with its first page, and is
+// freed with kfree_order().
+char*
+kalloc_order(int n)
+{
+  char *v;
+
+  if(n < 0 || n > MAXORDER)
+    return 0;
+  acquire(&kmem.lock);
+  if((v = balloc(n)) == 0 && n > 0 && kmem.zerolist){
+    // Zeroed pages may be what keeps the halves apart.
+    zeroflush();
+    v = balloc(n);
+  }
+  if(v)
+    kmem.ref[V2P(v)/PGSIZE] = 1;
+  release(&kmem.lock);
+  return v;
+}
+
+// Drop a reference to the 2^n pages at v, which must have been
+// returned by kalloc_order(n).  The last reference frees them.
+void
+kfree_order(char *v, int n)
+{
+  if(n < 0 || n > MAXORDER || V2P(v) % (PGSIZE << n) ||
+     v < end || V2P(v) >= PHYSTOP)
+    panic("kfree_order");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[V2P(v)/PGSIZE] > 1){
+    kmem.ref[V2P(v)/PGSIZE]--;
+    release(&kmem.lock);
+    return;
+  }
+  kmem.ref[V2P(v)/PGSIZE] = 0;
+#ifdef KJUNK
+  memset(v, 1, PGSIZE << n);
+#endif
+  bfree(v, n);
+  release(&kmem.lock);
 }
 
+// Allocate one 4 MB page of physical memory, aligned for a
+// PTE_PS mapping.  Returns 0 if no 4 MB block is free, as
+// happens once small pages are scattered over all of memory.
+// The page has one reference, kept with its first small page.
+char*
+kallocbig(void)
+{
+  return kalloc_order(MAXORDER);
+}
+
+// Drop a reference to the 4 MB page at v, which must have
+// been returned by kallocbig().
+void
+kfreebig(char *v)
+{
+  kfree_order(v, MAXORDER);
+}
+
+// Add a reference to the page at v, which must
+// have been returned by kalloc().  Each reference
+// is dropped by one call to kfree().
+void
+kincref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kincref");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[V2P(v)/PGSIZE] == 0)
+    panic("kincref: free page");
+  kmem.ref[V2P(v)/PGSIZE]++;
+  release(&kmem.lock);
+}
+
+// Return the number of references to the page at v.
+int
+kgetref(char *v)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.ref[V2P(v)/PGSIZE];
+  release(&kmem.lock);
+  return n;
+}
+
+// Return the number of free pages, on the shared lists and in
+// the magazines, which kalloc() takes when the lists run dry.
+// Without the locks it is only an estimate, which is all
+// swapping needs.
+int
+kfreecount(void)
+{
+  struct cpu *c;
+  int n;
+
+  n = kmem.nfreepages;
+  for(c = cpus; c < cpus+ncpu; c++)
+    n += c->nmag;
+  return n;
+}
+
+// Print allocator counters, and how fragmented free memory is:
+// the number of free blocks of each order, and the share of
+// free pages that lie in blocks of the largest order.
+void
+kallocstat(void)
+{
+  int k, n;
+
+  acquire(&kmem.lock);
+  n = kmem.nfreepages - kmem.nzero;
+  cprintf("free blocks by order:");
+  for(k = 0; k <= MAXORDER; k++)
+    cprintf(" %d", kmem.nblocks[k]);
+  cprintf("\n");
+  cprintf("free pages: %d, %d%% in %d KB blocks\n", n,
+          n ? (kmem.nblocks[MAXORDER] << MAXORDER) * 100 / n : 0,
+          (PGSIZE << MAXORDER) / 1024);
+  cprintf("zeroed pages: %d ready, %d taken, %d zeroed on demand\n",
+          kmem.nzero, kmem.zhits, kmem.zmisses);
+  cprintf("page magazines: %d refills, %d drains, %d steals\n",
+          kmem.refills, kmem.drains, kmem.steals);
+  release(&kmem.lock);
+}
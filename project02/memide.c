@@ -27,11 +27,19 @@ ideinit(void)
 
 // Interrupt handler.
 void
-ideintr(void)
+ideintr(int n)
 {
   // no-op
 }
 
+// Return whether disk dev is present.  There is
+// only the file system disk, so no swap.
+int
+idepresent(int dev)
+{
+  return dev == 1;
+}
+
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
@@ -0,0 +1,46 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define LIMIT (256*1024)
+#define HEAP (1024*1024)
+
+// Check that setmemorylimit() counts resident memory, not the
+// size of the address space, and covers pipes as well.
+int main(int argc, char *argv[])
+{
+  char *heap;
+  int i, npipe, fd[2];
+
+  printf(1, "Memory limit test start\n");
+
+  if (fork() == 0) {
+    if (setmemorylimit(getpid(), LIMIT) < 0) {
+      printf(1, "setmemorylimit failed\n");
+      exit();
+    }
+
+    // Reserving address space is free.
+    heap = sbrk(HEAP);
+    if (heap == (char*)-1) {
+      printf(1, "Test failed: sbrk over the limit\n");
+      exit();
+    }
+
+    // Pipe buffers are charged.
+    for (npipe = 0; npipe < 6 && pipe(fd) == 0; npipe++)
+      ;
+    printf(1, "%d pipes created\n", npipe);
+    procdump2();
+
+    // Touching the heap must run into the limit and kill us.
+    for (i = 0; i < HEAP; i += 4096)
+      heap[i] = 1;
+    printf(1, "Test failed: touched %d bytes over the limit\n", HEAP);
+    exit();
+  }
+  wait();
+
+  printf(1, "Memory limit test ok if no failure above\n");
+  exit();
+}
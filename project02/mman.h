@@ -0,0 +1,7 @@
+#define PROT_READ     0x1  // Pages may be read
+#define PROT_WRITE    0x2  // Pages may be written
+
+#define MAP_SHARED    0x01  // Children share the pages
+#define MAP_PRIVATE   0x02  // Children get copy-on-write pages
+#define MAP_ANONYMOUS 0x20  // Zeroed memory, not backed by a file
+#define MAP_HUGETLB   0x40000  // Use 4 MB pages where memory allows
@@ -0,0 +1,102 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "mman.h"
+
+#define PGSIZE 4096
+#define NUM_THREAD 4
+
+void failed(char *why)
+{
+  printf(1, "Test failed: %s\n", why);
+  exit();
+}
+
+char *anon(int len, int flags)
+{
+  char *p = mmap(0, len, PROT_READ|PROT_WRITE, flags|MAP_ANONYMOUS, -1, 0);
+
+  if (p == (char*)-1)
+    failed("mmap");
+  return p;
+}
+
+void *thread_main(void *arg)
+{
+  char *p = anon(PGSIZE, MAP_PRIVATE);
+
+  p[0] = (int)arg;
+  thread_exit(p);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  char *a, *b, *c, *d;
+  int i, fd[2];
+  thread_t thread[NUM_THREAD];
+  void *retval;
+
+  printf(1, "mmap test start\n");
+
+  // Private memory is zeroed and filled on first touch.
+  a = anon(4*PGSIZE, MAP_PRIVATE);
+  for (i = 0; i < 4*PGSIZE; i++)
+    if (a[i] != 0)
+      failed("not zeroed");
+  a[0] = 'a';
+  a[4*PGSIZE-1] = 'z';
+
+  // Memory is returned from the middle of the address space.
+  b = anon(PGSIZE, MAP_PRIVATE);
+  c = anon(PGSIZE, MAP_PRIVATE);
+  if (munmap(b, PGSIZE) < 0)
+    failed("munmap");
+  d = anon(PGSIZE, MAP_PRIVATE);
+  if (d != b)
+    failed("hole not reused");
+  if (munmap(a + PGSIZE, PGSIZE) < 0)
+    failed("munmap in the middle");
+  if (a[0] != 'a' || a[4*PGSIZE-1] != 'z')
+    failed("split lost data");
+  if (anon(PGSIZE, MAP_PRIVATE) != a + PGSIZE)
+    failed("split hole not reused");
+
+  // System calls can use mapped buffers.
+  if (pipe(fd) < 0)
+    failed("pipe");
+  if (write(fd[1], "mmap", 5) != 5 || read(fd[0], c, 5) != 5)
+    failed("pipe i/o");
+  if (strcmp(c, "mmap") != 0)
+    failed("pipe data");
+  close(fd[0]);
+  close(fd[1]);
+
+  // Children see shared pages and get copies of private ones.
+  b = anon(PGSIZE, MAP_SHARED);
+  if (fork() == 0) {
+    a[0] = 'c';
+    b[0] = 'c';
+    exit();
+  }
+  wait();
+  if (a[0] != 'a')
+    failed("private page shared with child");
+  if (b[0] != 'c')
+    failed("shared page not shared with child");
+
+  // Threads share mappings made by any of them.
+  for (i = 0; i < NUM_THREAD; i++)
+    if (thread_create(&thread[i], thread_main, (void*)i) != 0)
+      failed("thread_create");
+  for (i = 0; i < NUM_THREAD; i++) {
+    if (thread_join(thread[i], &retval) != 0)
+      failed("thread_join");
+    if (*(char*)retval != i)
+      failed("thread mapping");
+    munmap(retval, PGSIZE);
+  }
+
+  printf(1, "mmap test ok\n");
+  exit();
+}
@@ -3,13 +3,17 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NSPAWNFD      3  // fds passed to a child by spawn()
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
-
+#define FSSIZE       2000  // size of file system in blocks
+#define TLSSIZE      64  // bytes of thread-local storage (%gs) per thread
+#define NPROGSEG      4  // max loadable segments per program
+#define NPCACHE      64  // pages in the shared program text cache
+#define NVMA         16  // mmap() regions per process
+#define SWAPDEV       2  // device number of swap disk
+#define SWAPSIZE  131072  // size of swap disk in blocks
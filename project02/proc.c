@@ -6,6 +6,10 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
 
 struct {
   struct spinlock lock;
@@ -90,6 +94,10 @@ found:
   p->state = EMBRYO;
   p->pid = nextpid++;
   p->tid = nexttid++;
+  p->limit = 0;
+  p->rss = 0;
+  p->peak = 0;
+  p->insyscall = 0;
 
   release(&ptable.lock);
 
@@ -132,11 +140,13 @@ userinit(void)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
   p->sz = PGSIZE;
+  p->rss = 1;
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
   p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
   p->tf->es = p->tf->ds;
   p->tf->ss = p->tf->ds;
+  p->tf->gs = (SEG_UTLS << 3) | DPL_USER;
   p->tf->eflags = FL_IF;
   p->tf->esp = PGSIZE;
   p->tf->eip = 0;  // beginning of initcode.S
@@ -155,7 +165,151 @@ userinit(void)
   release(&ptable.lock);
 }
 
+// Bytes of p's address space in mmap() regions.
+static uint
+mapsize(struct proc *p)
+{
+  struct vma *v;
+  uint n;
+
+  n = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end)
+      n += v->end - v->start;
+  return n;
+}
+
+// The thread whose struct proc holds the memory
+// accounting of p's process.
+static struct proc*
+leader(struct proc *p)
+{
+  if(p->parent && p->parent->pid == p->pid)
+    return p->parent;
+  return p;
+}
+
+// Pages charged to the process of main thread p: resident user
+// pages, the page directory and page tables, the kernel stack
+// of each thread, and each pipe it has open.
+// Caller must hold ptable.lock.
+static uint
+mempages(struct proc *p)
+{
+  struct proc *t;
+  struct file *f;
+  int i, j;
+  uint n;
+
+  n = p->rss;
+  if(p->pgdir)
+    n += ptpages(p->pgdir);
+  for(t = ptable.proc; t < &ptable.proc[NPROC]; t++)
+    if(t->pid == p->pid && t->kstack)
+      n++;
+  for(i = 0; i < NOFILE; i++){
+    if((f = p->ofile[i]) == 0 || f->type != FD_PIPE)
+      continue;
+    for(j = 0; j < i; j++)
+      if(p->ofile[j] && p->ofile[j]->type == FD_PIPE &&
+         p->ofile[j]->pipe == f->pipe)
+        break;
+    if(j == i)
+      n++;
+  }
+  return n;
+}
+
+// Charge n more resident user pages to p's process, or
+// n fewer if n is negative, and track its peak usage.
+void
+memcharge(struct proc *p, int n)
+{
+  uint used;
+
+  acquire(&ptable.lock);
+  p = leader(p);
+  p->rss += n;
+  if((used = mempages(p)) > p->peak)
+    p->peak = used;
+  release(&ptable.lock);
+}
+
+// Return 0 if p's process may take n more pages of memory
+// under its limit, -1 if not.
+int
+memcheck(struct proc *p, int n)
+{
+  int r;
+
+  acquire(&ptable.lock);
+  p = leader(p);
+  r = 0;
+  if(p->limit != 0 && (mempages(p) + n) * PGSIZE > p->limit)
+    r = -1;
+  release(&ptable.lock);
+  return r;
+}
+
+// Return whether the pages of p's process may be swapped out
+// now.  p must be its main thread, and none of its threads may
+// be running on another cpu or be in a system call, since the
+// kernel uses user memory directly during system calls.
+// Caller must hold ptable.lock.
+static int
+swappable(struct proc *p)
+{
+  struct proc *t;
+
+  if(p->pgdir == 0 || leader(p) != p)
+    return 0;
+  if(p->state != RUNNABLE && p->state != SLEEPING && p->state != RUNNING)
+    return 0;
+  for(t = ptable.proc; t < &ptable.proc[NPROC]; t++){
+    if(t->pid != p->pid || t->state == UNUSED || t->state == ZOMBIE)
+      continue;
+    if(t->state == EMBRYO || t->insyscall)
+      return 0;
+    if(t->state == RUNNING && t != myproc())
+      return 0;
+  }
+  return 1;
+}
+
+// Choose up to n pages to swap out, moving a clock hand over
+// the address space of each process in turn.  A page is taken
+// if the hand passed it before without it being used since, so
+// two sweeps find a page wherever one can be taken.  Returns
+// the number of pages taken, with their pages and swap slots
+// in page[] and slot[].  Caller must hold swaplock().
+int
+swapscan(char **page, uint *slot, int n)
+{
+  static int hand;             // Process slot the hand is in
+  static uint va;              // and where in its address space
+  struct proc *p;
+  int i, k, got;
+
+  k = 0;
+  acquire(&ptable.lock);
+  for(i = 0; i <= 2*NPROC && k < n; i++){
+    p = &ptable.proc[hand];
+    if(swappable(p)){
+      got = clockscan(p, &va, page + k, slot + k, n - k);
+      p->rss -= got;
+      k += got;
+    } else
+      va = 0;
+    if(va == 0)
+      hand = (hand + 1) % NPROC;
+  }
+  release(&ptable.lock);
+  return k;
+}
+
 // Grow current process's memory by n bytes.
+// Pages count against the memory limit when they
+// are touched, not here.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
@@ -166,14 +320,14 @@ growproc(int n)
 
   sz = curproc->sz;
 
-  // Check the limit of the current process.
-  if(curproc->limit != 0 && sz + n > curproc->limit)
-    return -1;
-
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Only reserve the range; trap() allocates each page
+    // on first touch (see lazyfault in vm.c).
+    if(sz + n < sz || sz + n > MMAPBASE)
       return -1;
+    sz += n;
   } else if(n < 0){
+    memcharge(curproc, -upages(curproc->pgdir, sz + n, sz));
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   }
@@ -192,6 +346,164 @@ growproc(int n)
   return 0;
 }
 
+// Copy the mmap() regions of the current thread to the
+// other threads of its process.  Caller must hold ptable.lock.
+static void
+syncvma(void)
+{
+  struct proc *t;
+  struct proc *curproc = myproc();
+
+  for(t = ptable.proc; t < &ptable.proc[NPROC]; t++)
+    if(t->pid == curproc->pid && t != curproc)
+      memmove(t->vma, curproc->vma, sizeof(curproc->vma));
+}
+
+// Map len bytes of zeroed memory into the current process at
+// an address between MMAPBASE and KERNBASE of the kernel's
+// choosing.  Private regions are filled on first touch.
+// Shared regions are filled now, so that children forked later
+// find the same pages.  Private MAP_HUGETLB regions are 4 MB
+// aligned and use 4 MB pages while free memory allows.
+// Returns the address, or -1.
+int
+mmap(uint len, int prot, int flags)
+{
+  uint start, end, align;
+  int perm;
+  struct vma *v, *w;
+  struct proc *curproc = myproc();
+
+  if((flags & MAP_ANONYMOUS) == 0)
+    return -1;
+  if(((flags & MAP_SHARED) == 0) == ((flags & MAP_PRIVATE) == 0))
+    return -1;
+  if((flags & MAP_HUGETLB) && (flags & MAP_SHARED))
+    return -1;
+  if(len == 0 || len > KERNBASE - MMAPBASE)
+    return -1;
+  align = (flags & MAP_HUGETLB) ? BIGPGSIZE : PGSIZE;
+  len = (len + align - 1) & ~(align - 1);
+
+  if((flags & MAP_SHARED) && memcheck(curproc, len / PGSIZE) < 0)
+    return -1;
+
+  acquire(&ptable.lock);
+
+  // Take the lowest gap that fits.
+  v = 0;
+  for(w = curproc->vma; w < &curproc->vma[NVMA]; w++)
+    if(w->end == 0){
+      v = w;
+      break;
+    }
+  if(v == 0)
+    goto bad;
+  start = MMAPBASE;
+  for(;;){
+    end = start + len;
+    if(end > KERNBASE || end < start)
+      goto bad;
+    for(w = curproc->vma; w < &curproc->vma[NVMA]; w++)
+      if(w->end && w->start < end && start < w->end)
+        break;
+    if(w == &curproc->vma[NVMA])
+      break;
+    start = (w->end + align - 1) & ~(align - 1);
+  }
+  v->start = start;
+  v->end = end;
+  v->prot = prot;
+  v->flags = flags;
+  syncvma();
+
+  release(&ptable.lock);
+
+  if(flags & MAP_SHARED){
+    perm = PTE_U;
+    if(prot & PROT_WRITE)
+      perm |= PTE_W;
+    if(mapzero(curproc->pgdir, start, end, perm) < 0){
+      memcharge(curproc, upages(curproc->pgdir, start, end));
+      munmap(start, len);
+      return -1;
+    }
+    memcharge(curproc, len / PGSIZE);
+  }
+  return start;
+
+bad:
+  release(&ptable.lock);
+  return -1;
+}
+
+// Remove [addr, addr+len) from the mmap() regions of the
+// current process and release its pages.  Pages shared with
+// other processes are freed by the last one to let go.
+// MAP_HUGETLB regions only lose whole 4 MB pages.
+int
+munmap(uint addr, uint len)
+{
+  uint end;
+  struct vma *v, *w, *split;
+  struct proc *curproc = myproc();
+
+  // Check addr first: KERNBASE - addr wraps for kernel addresses.
+  if(addr % PGSIZE || addr < MMAPBASE || addr >= KERNBASE ||
+     len == 0 || len > KERNBASE - addr)
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  acquire(&ptable.lock);
+
+  for(v = curproc->vma; v < &curproc->vma[NVMA]; v++){
+    if(v->end && (v->flags & MAP_HUGETLB) &&
+       v->start < end && addr < v->end &&
+       ((v->start < addr && addr % BIGPGSIZE) ||
+        (end < v->end && end % BIGPGSIZE))){
+      release(&ptable.lock);
+      return -1;
+    }
+  }
+
+  // Punching a hole in a region takes a second entry.
+  split = 0;
+  for(v = curproc->vma; v < &curproc->vma[NVMA]; v++){
+    if(v->end && v->start < addr && end < v->end){
+      for(w = curproc->vma; w < &curproc->vma[NVMA]; w++)
+        if(w->end == 0)
+          break;
+      if(w == &curproc->vma[NVMA]){
+        release(&ptable.lock);
+        return -1;
+      }
+      *w = *v;
+      w->start = end;
+      v->end = addr;
+      split = w;
+      break;
+    }
+  }
+
+  for(v = curproc->vma; v < &curproc->vma[NVMA]; v++){
+    if(v->end == 0 || v == split || v->end <= addr || end <= v->start)
+      continue;
+    if(addr <= v->start && v->end <= end)
+      v->end = 0;
+    else if(addr <= v->start)
+      v->start = end;
+    else
+      v->end = addr;
+  }
+  syncvma();
+
+  release(&ptable.lock);
+
+  memcharge(curproc, -upages(curproc->pgdir, addr, end));
+  deallocuvm(curproc->pgdir, end, addr);
+  return 0;
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
@@ -208,13 +520,17 @@ fork(void)
   }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz, curproc->vma)) == 0){
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
     return -1;
   }
   np->sz = curproc->sz;
+  np->tls = curproc->tls;
+  memmove(np->vma, curproc->vma, sizeof(curproc->vma));
+  // The child maps the same pages, and 4 MB ones are copied.
+  np->rss = leader(curproc)->rss;
   np->parent = curproc;
   *np->tf = *curproc->tf;
 
@@ -225,8 +541,81 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  np->exe = 0;
+  if(curproc->exe)
+    np->exe = idup(curproc->exe);
+  np->nseg = curproc->nseg;
+  memmove(np->seg, curproc->seg, sizeof(curproc->seg));
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+  memcharge(np, 0);
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  np->state = RUNNABLE;
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
+// Start program path with arguments argv in a new child process.
+// Unlike fork()+exec(), the image is built directly for the child,
+// so the caller's address space is never copied.  If fdmap is not
+// 0, child fd i is a duplicate of the caller's fd fdmap[i] for
+// i < NSPAWNFD, or closed if fdmap[i] < 0, and no other files are
+// inherited.  If fdmap is 0, the child inherits every open file.
+// Returns the pid of the child, or -1.
+int
+spawn(char *path, char **argv, int *fdmap)
+{
+  int i, fd, pid;
+  pde_t *oldpgdir;
+  struct inode *oldexe;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+
+  // Start from an empty user image, as userinit() does.
+  np->pgdir = 0;
+  np->sz = 0;
+  np->exe = 0;
+  np->nseg = 0;
+  np->limit = 0;
+  memset(np->tf, 0, sizeof(*np->tf));
+  np->tf->cs = (SEG_UCODE << 3) | DPL_USER;
+  np->tf->ds = (SEG_UDATA << 3) | DPL_USER;
+  np->tf->es = np->tf->ds;
+  np->tf->ss = np->tf->ds;
+  np->tf->eflags = FL_IF;
+
+  if(execimage(np, path, argv, 1, &oldpgdir, &oldexe) < 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  np->parent = curproc;
+
+  if(fdmap == 0){
+    for(i = 0; i < NOFILE; i++)
+      if(curproc->ofile[i])
+        np->ofile[i] = filedup(curproc->ofile[i]);
+  } else {
+    for(i = 0; i < NSPAWNFD; i++){
+      fd = fdmap[i];
+      if(fd >= 0 && fd < NOFILE && curproc->ofile[fd])
+        np->ofile[i] = filedup(curproc->ofile[fd]);
+    }
+  }
+  np->cwd = idup(curproc->cwd);
+  memcharge(np, 0);
 
   pid = np->pid;
 
@@ -262,11 +651,17 @@ exit(void)
 
   begin_op();
   iput(curproc->cwd);
+  if(curproc->exe)
+    iput(curproc->exe);
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
 
   acquire(&ptable.lock);
 
+  // The pages go with the page table in wait().
+  memset(curproc->vma, 0, sizeof(curproc->vma));
+
   // Clean up all other threads.
   thread_clear1();
 
@@ -345,6 +740,7 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int idle;
   c->proc = 0;
   
   for(;;){
@@ -352,10 +748,12 @@ scheduler(void)
     sti();
 
     // Loop over process table looking for process to run.
+    idle = 1;
     acquire(&ptable.lock);
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
       if(p->state != RUNNABLE)
         continue;
+      idle = 0;
 
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
@@ -365,6 +763,7 @@ scheduler(void)
       p->state = RUNNING;
       swtch(&(c->scheduler), p->context);
       switchkvm();
+      c->pgdir = 0;
   
       // Process is done running for now.
       // It should have changed its p->state before coming back.
@@ -372,6 +771,9 @@ scheduler(void)
     }
     release(&ptable.lock);
 
+    // Nothing to run: zero a page for kalloc_zeroed().
+    if(idle)
+      kzeroidle();
   }
 }
 
@@ -560,7 +962,9 @@ void
 procdump2(void)
 {
   struct proc *p;
+  uint used;
 
+  acquire(&ptable.lock);
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if((p->state != RUNNING && p->state != RUNNABLE && p->state != SLEEPING) 
         || p->pid == p->parent->pid)
@@ -569,13 +973,25 @@ procdump2(void)
     cprintf("name                  : %s\n", p->name);
     cprintf("pid                   : %d\n", p->pid);
     cprintf("stack page number     : %d\n", p->spnum);
-    cprintf("allocated memory size : %d\n", p->sz);
+    cprintf("virtual memory size   : %d\n", p->sz + mapsize(p));
+    used = mempages(p);
+    if(used > p->peak)
+      p->peak = used;
+    cprintf("resident memory size  : %d\n", used * PGSIZE);
+    cprintf("peak memory size      : %d\n", p->peak * PGSIZE);
     if(p->limit == 0)
       cprintf("memory maximum limit  : no limit\n");
     else
       cprintf("memory maximum limit  : %d\n", p->limit);
     cprintf("**************************************\n");
   }
+  release(&ptable.lock);
+  tlbstat();
+  pcstat();
+  bigpgstat();
+  swapstat();
+  kallocstat();
+  slabstat();
 }
 
 // Set the limit of process memory
@@ -589,7 +1005,7 @@ setmemorylimit(int pid, int limit)
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->pid == pid){
       // If the limit is smaller than current process memory size.
-      if(limit != 0 && limit < p->sz) { 
+      if(limit != 0 && limit < mempages(leader(p)) * PGSIZE) { 
         release(&ptable.lock);
         return -1;
       }
@@ -614,8 +1030,10 @@ thread_create(thread_t *thread, void *(*start_routine)(void *), void* arg)
   struct proc *t;
   struct proc *curproc = myproc();
 
-  // Check the limit of the current process.
-  if(curproc->limit != 0 && curproc->sz + PGSIZE > curproc->limit)
+  // Check the limit for the stack and the kernel stack.
+  if(memcheck(curproc, 2) < 0)
+    return -1;
+  if(curproc->sz + PGSIZE > MMAPBASE)
     return -1;
 
   // Allocate process.
@@ -631,6 +1049,7 @@ thread_create(thread_t *thread, void *(*start_routine)(void *), void* arg)
     t->state = UNUSED;
     return -1;
   }
+  memcharge(curproc, 1);
 
   // Share thread state with current process.
   t->pid = curproc->pid;
@@ -650,9 +1069,14 @@ thread_create(thread_t *thread, void *(*start_routine)(void *), void* arg)
   // Increase the stack page number of the main thread
   t->parent->spnum++;
 
-  // Strat from the start routine and set sp to top of the page
+  // Reserve the thread-local storage block at the top of the page.
+  t->tls = t->sz - TLSSIZE;
+  *(uint*)t->tls = t->tls;
+  t->tf->gs = (SEG_UTLS << 3) | DPL_USER;
+
+  // Strat from the start routine and set sp below the TLS block
   t->tf->eip = (uint)start_routine;
-  t->tf->esp = (uint)t->sz;
+  t->tf->esp = t->tls;
 
   // Pass the argument to the stack
   t->tf->esp -= 4;
@@ -670,6 +1094,12 @@ thread_create(thread_t *thread, void *(*start_routine)(void *), void* arg)
   // Copy the address of the current derectory widout idup().
   t->cwd = curproc->cwd;
 
+  // Share the program file the same way.
+  t->exe = curproc->exe;
+  t->nseg = curproc->nseg;
+  memmove(t->seg, curproc->seg, sizeof(curproc->seg));
+  memmove(t->vma, curproc->vma, sizeof(curproc->vma));
+
   safestrcpy(t->name, curproc->name, sizeof(curproc->name));
 
   *thread = t->tid;
@@ -705,6 +1135,7 @@ thread_exit(void *retval)
   for(fd = 0; fd < NOFILE; fd++)
       curproc->ofile[fd] = 0;
   curproc->cwd = 0;
+  curproc->exe = 0;
 
   curproc->threadretval = retval;
 
@@ -749,6 +1180,7 @@ int thread_join(thread_t thread, void **retval)
         t->name[0] = 0;
         t->killed = 0;
         t->limit = 0;
+        t->tls = 0;
         t->state = UNUSED;
         
         *retval = t->threadretval;
@@ -780,6 +1212,8 @@ thread_clear1(void)
   // Make the current thread to the main thread
   if(curproc->parent->pid == curproc->pid) {
     curproc->spnum = curproc->parent->spnum;
+    if(curproc->parent->peak > curproc->peak)
+      curproc->peak = curproc->parent->peak;
     curproc->parent = curproc->parent->parent;
   }
 
@@ -798,6 +1232,7 @@ thread_clear1(void)
     for(fd = 0; fd < NOFILE; fd++)
       t->ofile[fd] = 0;
     t->cwd = 0;
+    t->exe = 0;
     kfree(t->kstack);
     t->kstack = 0;
     t->pgdir = 0;
@@ -809,6 +1244,8 @@ thread_clear1(void)
     t->limit = 0;
     t->spnum = 0;
     t->threadretval = 0;
+    t->tls = 0;
+    memset(t->vma, 0, sizeof(t->vma));
     t->state = UNUSED;
   }
 }
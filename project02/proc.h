@@ -8,6 +8,11 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  pde_t *pgdir;                // Page table loaded in %cr3
+  volatile uint tlbpending;    // TLB shootdown waiting for this cpu
+  struct run *mag;             // Free pages this cpu allocates first
+  int nmag;                    // Pages in mag
+  volatile uint magbusy;       // mag is locked
 };
 
 extern struct cpu cpus[NCPU];
@@ -44,6 +49,24 @@ struct thread {
   void *chan;                  // If non-zero, sleeping on chan  
 };
 
+// Loadable segment of the running program.  exec() records
+// these, and execfault() fills pages from them on first touch.
+struct execseg {
+  uint va;                     // Virtual address of the segment
+  uint memsz;                  // Size in memory
+  uint off;                    // Offset in the program file
+  uint filesz;                 // Size in the program file
+  int writable;                // Private pages if set, shared otherwise
+};
+
+// Region of memory created by mmap().  Unused if end is 0.
+struct vma {
+  uint start;                  // First address, page-aligned
+  uint end;                    // One past the last address
+  int prot;                    // PROT_ bits from mman.h
+  int flags;                   // MAP_ bits from mman.h
+};
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
@@ -57,14 +80,22 @@ struct proc {
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
+  int insyscall;               // In a system call; see swapscan()
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
 
-  int limit;                   // Limit of memory size
+  int limit;                   // Limit of memory charged, in bytes
+  uint rss;                    // Resident user pages (main thread only)
+  uint peak;                   // Most pages ever charged (main thread only)
   int spnum;                   // The number of stack pages
   thread_t tid;                // Thread ID
   void *threadretval;          // Return value of thread exit
+  uint tls;                    // Base of thread-local storage (%gs)
+  struct inode *exe;           // Program file, for demand paging
+  int nseg;                    // Number of program segments
+  struct execseg seg[NPROGSEG];  // Program segments
+  struct vma vma[NVMA];        // mmap() regions, the same in every thread
 };
 
 
@@ -74,3 +105,5 @@ struct proc {
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
+//   ...
+//   mmap() regions, from MMAPBASE up to KERNBASE
@@ -0,0 +1,44 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define HEAPSIZE (8*1024*1024)  // heap grown and touched per run
+#define NRUN 20
+#define NFORK 200
+
+// Measure how fast fresh memory can be had: growing the heap and
+// touching every page of it, and fork()+exit() of a small process
+// with a page table and stack to set up.  Both need zeroed pages,
+// which idle cpus prepare ahead of time between runs.
+int main(int argc, char *argv[])
+{
+  char *heap;
+  int i, j, start, ticks;
+
+  ticks = 0;
+  for (i = 0; i < NRUN; i++) {
+    sleep(5);
+    start = uptime();
+    heap = sbrk(HEAPSIZE);
+    if (heap == (char *)-1) {
+      printf(1, "sbrk failed\n");
+      exit();
+    }
+    for (j = 0; j < HEAPSIZE; j += 4096)
+      heap[j] = j;
+    sbrk(-HEAPSIZE);
+    ticks += uptime() - start;
+  }
+  printf(1, "sbrk+touch of %d MB: %d ticks for %d runs\n",
+         HEAPSIZE / (1024*1024), ticks, NRUN);
+
+  start = uptime();
+  for (i = 0; i < NFORK; i++) {
+    if (fork() == 0)
+      exit();
+    wait();
+  }
+  printf(1, "fork+exit: %d ticks for %d runs\n", uptime() - start, NFORK);
+  procdump2();
+  exit();
+}
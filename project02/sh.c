@@ -1,6 +1,7 @@
 // Shell.
 
 #include "types.h"
+#include "param.h"
 #include "user.h"
 #include "fcntl.h"
 
@@ -12,6 +13,7 @@
 #define BACK  5
 
 #define MAXARGS 10
+#define MAXFG   64
 
 struct cmd {
   int type;
@@ -52,6 +54,10 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
+
+int fg[MAXFG];  // foreground children not yet waited for
+int nfg;
 
 // Execute cmd.  Never returns.
 void
@@ -130,6 +136,151 @@ runcmd(struct cmd *cmd)
   exit();
 }
 
+// Remember a foreground child to wait for.
+void
+addfg(int pid)
+{
+  if(pid > 0 && nfg < MAXFG)
+    fg[nfg++] = pid;
+}
+
+// Wait for all foreground children.
+void
+waitfg(void)
+{
+  int i, pid;
+
+  while(nfg > 0){
+    if((pid = wait()) < 0){
+      nfg = 0;
+      break;
+    }
+    for(i = 0; i < nfg; i++){
+      if(fg[i] == pid){
+        fg[i] = fg[--nfg];
+        break;
+      }
+    }
+  }
+}
+
+// Run cmd in a forked copy of the shell, with fds 0-2
+// taken from fdmap.  Returns the pid of the copy.
+int
+forkcmd(struct cmd *cmd, int *fdmap)
+{
+  int fd, pid;
+
+  if((pid = fork1()) == 0){
+    for(fd = 0; fd < NSPAWNFD; fd++){
+      if(fdmap[fd] != fd){
+        close(fd);
+        dup(fdmap[fd]);
+      }
+    }
+    for(fd = NSPAWNFD; fd < NOFILE; fd++)
+      close(fd);
+    runcmd(cmd);
+  }
+  return pid;
+}
+
+// Can cmd be started with spawn() alone?  Lists and
+// background jobs wait or fork on their own, so inside
+// a pipeline they need a subshell.
+int
+spawnable(struct cmd *cmd)
+{
+  struct pipecmd *pcmd;
+
+  switch(cmd->type){
+  case EXEC:
+    return 1;
+  case REDIR:
+    return spawnable(((struct redircmd*)cmd)->cmd);
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    return spawnable(pcmd->left) && spawnable(pcmd->right);
+  }
+  return 0;
+}
+
+// Start cmd with fds 0-2 taken from fdmap.  Programs are
+// started with spawn() instead of fork()+exec(), so the shell
+// is never copied.  Returns without waiting; the children to
+// wait for are recorded by addfg().
+void
+spawncmd(struct cmd *cmd, int *fdmap)
+{
+  int p[2], fd, map[NSPAWNFD];
+  struct execcmd *ecmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  default:
+    panic("spawncmd");
+
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return;
+    if((fd = spawn(ecmd->argv[0], ecmd->argv, fdmap)) < 0)
+      printf(2, "exec %s failed\n", ecmd->argv[0]);
+    addfg(fd);
+    break;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      printf(2, "open %s failed\n", rcmd->file);
+      return;
+    }
+    memmove(map, fdmap, sizeof(map));
+    map[rcmd->fd] = fd;
+    spawncmd(rcmd->cmd, map);
+    close(fd);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    spawncmd(lcmd->left, fdmap);
+    waitfg();
+    spawncmd(lcmd->right, fdmap);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0)
+      panic("pipe");
+    memmove(map, fdmap, sizeof(map));
+    map[1] = p[1];
+    if(spawnable(pcmd->left))
+      spawncmd(pcmd->left, map);
+    else
+      addfg(forkcmd(pcmd->left, map));
+    memmove(map, fdmap, sizeof(map));
+    map[0] = p[0];
+    if(spawnable(pcmd->right))
+      spawncmd(pcmd->right, map);
+    else
+      addfg(forkcmd(pcmd->right, map));
+    close(p[0]);
+    close(p[1]);
+    break;
+
+  case BACK:
+    // A forked shell starts the job and exits at once,
+    // so the job is inherited by init, not by us.
+    addfg(forkcmd(cmd, fdmap));
+    break;
+  }
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -145,7 +296,9 @@ int
 main(void)
 {
   static char buf[100];
+  static int stdfd[NSPAWNFD] = { 0, 1, 2 };
   int fd;
+  struct cmd *cmd;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -164,9 +317,11 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait();
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    spawncmd(cmd, stdfd);
+    waitfg();
+    freecmd(cmd);
   }
   exit();
 }
@@ -319,6 +474,18 @@ peek(char **ps, char *es, char *toks)
   return *s && strchr(toks, *s);
 }
 
+int parseerr;
+
+// Report a syntax error.  The shell parses commands itself,
+// so a bad line is dropped instead of exiting.
+void
+synerr(char *s)
+{
+  if(!parseerr)
+    printf(2, "%s\n", s);
+  parseerr = 1;
+}
+
 struct cmd *parseline(char**, char*);
 struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
@@ -330,12 +497,17 @@ parsecmd(char *s)
   char *es;
   struct cmd *cmd;
 
+  parseerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !parseerr){
     printf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    synerr("syntax");
+  }
+  if(parseerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +551,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      synerr("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +579,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    synerr("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +607,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      synerr("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      synerr("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -491,3 +671,41 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free a parsed command.
+void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    freecmd(rcmd->cmd);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
@@ -0,0 +1,222 @@
+// Object caches for small kernel objects, such as pipes, open
+// files and in-memory inodes, so that each takes only its own
+// size instead of a page or a slot in a fixed table.
+//
+// A cache hands out objects of one size, carved from slabs of
+// one page each.  A slab starts with a header, followed by as
+// many objects as fit.  Each object is followed by a link word
+// for the slab's free list, so a free object keeps its
+// contents: the constructor runs once when the slab is made,
+// and an object must be back in its constructed state (locks
+// released, say) when it is freed.  Each cpu keeps a magazine
+// of free objects, so most slaballoc() and slabfree() calls
+// take no lock, as with pages in kalloc.c.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define NSLABCACHE   8  // object caches in all
+#define NSLABMAG    16  // most free objects in a cpu's magazine
+#define SLABBATCH    8  // objects moved to or from a magazine at once
+
+struct slab {
+  struct slab *next;           // On the cache's list of partial slabs
+  struct slab *prev;
+  struct slabcache *cache;
+  void *free;                  // Free objects in this slab
+  int inuse;                   // Objects allocated, or in magazines
+};
+
+struct slabcache {
+  struct spinlock lock;
+  char *name;
+  uint size;                   // Object size, as asked for
+  uint stride;                 // Object size plus link word, aligned
+  int perslab;                 // Objects in each slab
+  void (*ctor)(void*);
+  struct slab *partial;        // Slabs with free objects
+  int nslab;                   // Slabs in all
+  int inuse;                   // Objects out of slabs, magazines too
+  struct {
+    int n;
+    void *obj[NSLABMAG];
+  } mag[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  struct slabcache cache[NSLABCACHE];
+  int n;
+} slabs;
+
+// The link word after object v.
+#define LINK(c, v) (*(void**)((char*)(v) + (c)->size))
+
+// Make a cache of objects of size bytes.  ctor, if not 0,
+// prepares each object when its slab is made.
+struct slabcache*
+slabcreate(char *name, uint size, void (*ctor)(void*))
+{
+  struct slabcache *c;
+
+  if(slabs.n == 0)
+    initlock(&slabs.lock, "slabs");
+  acquire(&slabs.lock);
+  if(slabs.n == NSLABCACHE)
+    panic("slabcreate: too many caches");
+  c = &slabs.cache[slabs.n++];
+  release(&slabs.lock);
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = (size + 3) & ~3;
+  c->stride = c->size + sizeof(void*);
+  c->perslab = (PGSIZE - sizeof(struct slab)) / c->stride;
+  if(c->perslab < 1)
+    panic("slabcreate: object too big");
+  c->ctor = ctor;
+  return c;
+}
+
+// Unlink s from the partial list.  Caller holds c->lock.
+static void
+slabunlink(struct slabcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Put s on the partial list.  Caller holds c->lock.
+static void
+slabpush(struct slabcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+}
+
+// Make a new slab for c.  Caller holds c->lock.
+static struct slab*
+slabgrow(struct slabcache *c)
+{
+  struct slab *s;
+  char *v;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  memset(s, 0, PGSIZE);
+  s->cache = c;
+  for(i = c->perslab - 1; i >= 0; i--){
+    v = (char*)(s + 1) + i*c->stride;
+    if(c->ctor)
+      c->ctor(v);
+    LINK(c, v) = s->free;
+    s->free = v;
+  }
+  slabpush(c, s);
+  c->nslab++;
+  return s;
+}
+
+// Take an object from c's slabs.  Caller holds c->lock.
+static void*
+slabget(struct slabcache *c)
+{
+  struct slab *s;
+  void *v;
+
+  if((s = c->partial) == 0 && (s = slabgrow(c)) == 0)
+    return 0;
+  v = s->free;
+  s->free = LINK(c, v);
+  if(++s->inuse == c->perslab)
+    slabunlink(c, s);
+  c->inuse++;
+  return v;
+}
+
+// Give object v back to its slab, and the slab back to
+// kalloc if that was its last object.  Caller holds c->lock.
+static void
+slabput(struct slabcache *c, void *v)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)v);
+  if(s->cache != c)
+    panic("slabfree");
+  if(s->inuse-- == c->perslab)
+    slabpush(c, s);
+  LINK(c, v) = s->free;
+  s->free = v;
+  c->inuse--;
+  if(s->inuse == 0){
+    slabunlink(c, s);
+    c->nslab--;
+    kfree((char*)s);
+  }
+}
+
+// Allocate an object from c.  Returns 0 if memory is exhausted.
+void*
+slaballoc(struct slabcache *c)
+{
+  void *v;
+  int id;
+
+  pushcli();
+  id = cpuid();
+  if(c->mag[id].n == 0){
+    acquire(&c->lock);
+    while(c->mag[id].n < SLABBATCH && (v = slabget(c)) != 0)
+      c->mag[id].obj[c->mag[id].n++] = v;
+    release(&c->lock);
+  }
+  v = 0;
+  if(c->mag[id].n > 0)
+    v = c->mag[id].obj[--c->mag[id].n];
+  popcli();
+  return v;
+}
+
+// Free object v, which must have come from slaballoc(c).
+void
+slabfree(struct slabcache *c, void *v)
+{
+  int id;
+
+  pushcli();
+  id = cpuid();
+  if(c->mag[id].n == NSLABMAG){
+    // Give a batch back.
+    acquire(&c->lock);
+    while(c->mag[id].n > NSLABMAG - SLABBATCH)
+      slabput(c, c->mag[id].obj[--c->mag[id].n]);
+    release(&c->lock);
+  }
+  c->mag[id].obj[c->mag[id].n++] = v;
+  popcli();
+}
+
+// Print how many objects and slabs each cache holds.
+void
+slabstat(void)
+{
+  struct slabcache *c;
+
+  for(c = slabs.cache; c < &slabs.cache[slabs.n]; c++)
+    cprintf("slab %s: %d objects of %d bytes in use, %d slabs\n",
+            c->name, c->inuse, c->size, c->nslab);
+}
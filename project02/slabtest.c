@@ -0,0 +1,113 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define NCHILD 16
+#define NFILES 5   // files each child opens
+#define NPIPES 3   // pipes each child makes
+
+static void
+fname(char *name, int i)
+{
+  name[0] = 's';
+  name[1] = 'f';
+  name[2] = '0' + i / 10;
+  name[3] = '0' + i % 10;
+  name[4] = 0;
+}
+
+// Tell the parent this child failed, so it does not wait for it.
+static void
+fail(int fd)
+{
+  write(fd, "f", 1);
+  exit();
+}
+
+// Object cache test: children together hold more open files,
+// pipes and active inodes than the old fixed tables had room
+// for (100 files, 50 inodes), and check that all of them work.
+int main(int argc, char *argv[])
+{
+  int i, j, k, pid, ok, report[2], ctl[2], p[NPIPES][2];
+  char name[8], c;
+
+  printf(1, "Slab test start\n");
+  for (i = 0; i < NCHILD * NFILES; i++) {
+    fname(name, i);
+    if ((k = open(name, O_CREATE | O_RDWR)) < 0) {
+      printf(1, "create %s failed\n", name);
+      exit();
+    }
+    close(k);
+  }
+  if (pipe(report) < 0 || pipe(ctl) < 0) {
+    printf(1, "pipe failed\n");
+    exit();
+  }
+
+  for (i = 0; i < NCHILD; i++) {
+    if ((pid = fork()) < 0) {
+      printf(1, "fork failed\n");
+      break;
+    }
+    if (pid == 0) {
+      close(report[0]);
+      close(ctl[1]);
+      for (j = 0; j < NFILES; j++) {
+        fname(name, i * NFILES + j);
+        if (open(name, O_RDWR) < 0) {
+          printf(1, "child %d: open %s failed\n", i, name);
+          fail(report[1]);
+        }
+      }
+      for (j = 0; j < NPIPES; j++) {
+        if (pipe(p[j]) < 0) {
+          printf(1, "child %d: pipe failed\n", i);
+          fail(report[1]);
+        }
+      }
+      // Hold everything until all children are done opening.
+      write(report[1], "o", 1);
+      read(ctl[0], &c, 1);
+      for (j = 0; j < NPIPES; j++) {
+        c = 'a' + j;
+        if (write(p[j][1], &c, 1) != 1 || read(p[j][0], &c, 1) != 1 ||
+            c != 'a' + j) {
+          printf(1, "child %d: pipe %d broken\n", i, j);
+          fail(report[1]);
+        }
+      }
+      write(report[1], "k", 1);
+      exit();
+    }
+  }
+  close(report[1]);
+  close(ctl[0]);
+
+  // Wait until every child holds its files, then let them go.
+  for (j = 0; j < i && read(report[0], &c, 1) == 1 && c == 'o'; j++)
+    ;
+  procdump2();
+  close(ctl[1]);
+
+  ok = 0;
+  while (read(report[0], &c, 1) == 1)
+    if (c == 'k')
+      ok++;
+  while (wait() >= 0)
+    ;
+
+  for (i = 0; i < NCHILD * NFILES; i++) {
+    fname(name, i);
+    unlink(name);
+  }
+
+  printf(1, "%d of %d children ok\n", ok, NCHILD);
+  if (ok == NCHILD)
+    printf(1, "Slab test ok\n");
+  else
+    printf(1, "Test failed\n");
+  exit();
+}
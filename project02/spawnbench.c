@@ -0,0 +1,51 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NRUN 200
+#define HEAP (4*1024*1024)
+
+// Compare how many commands per second fork()+exec() and
+// spawn() can start from a parent with a 4 MB heap, as a
+// shell with a large history would have.
+int main(int argc, char *argv[])
+{
+  char *args[] = { "spawnbench", "child", 0 };
+  char *heap;
+  int i, start, forkticks, spawnticks;
+
+  if (argc > 1 && strcmp(argv[1], "child") == 0)
+    exit();
+
+  heap = sbrk(HEAP);
+  if (heap == (char*)-1) {
+    printf(1, "sbrk failed\n");
+    exit();
+  }
+  memset(heap, 1, HEAP);
+
+  start = uptime();
+  for (i = 0; i < NRUN; i++) {
+    if (fork() == 0) {
+      exec(args[0], args);
+      printf(1, "exec failed\n");
+      exit();
+    }
+    wait();
+  }
+  forkticks = uptime() - start;
+
+  start = uptime();
+  for (i = 0; i < NRUN; i++) {
+    if (spawn(args[0], args, 0) < 0) {
+      printf(1, "spawn failed\n");
+      exit();
+    }
+    wait();
+  }
+  spawnticks = uptime() - start;
+
+  printf(1, "fork+exec: %d commands in %d ticks\n", NRUN, forkticks);
+  printf(1, "spawn: %d commands in %d ticks\n", NRUN, spawnticks);
+  exit();
+}
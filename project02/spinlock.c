@@ -28,9 +28,10 @@ acquire(struct spinlock *lk)
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
+  // The xchg is atomic.  Interrupts are off while spinning,
+  // so answer TLB shootdowns here instead (see vm.c).
   while(xchg(&lk->locked, 1) != 0)
-    ;
+    tlbserve();
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
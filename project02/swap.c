@@ -0,0 +1,177 @@
+// Swap space.  When free memory runs low, ualloc() writes user
+// pages that were not used recently to the swap disk, choosing
+// them with swapscan() in proc.c and clockscan() in vm.c, and
+// lazyfault() reads them back on their next touch.  The swap
+// disk is divided into page-sized slots; a PTE of a page that
+// is out holds its slot number and PTE_SWAP instead of PTE_P.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+
+#define NSLOT        (SWAPSIZE / (PGSIZE/BSIZE))
+#define NSWAPBATCH   32  // pages written out by one swapout()
+#define NSWAPRESERVE 64  // free pages kept for the kernel's own use
+
+struct {
+  struct spinlock lock;        // Protects ref, hint and the counters
+  // The lock of buf is held for all disk I/O and across each
+  // swap-out and swap-in, so that a slot is never read while
+  // its page is still being written.
+  struct buf buf;
+  int nslot;                   // Slots on the swap disk; 0 if none
+  int nused;
+  int hint;                    // Where to look for a free slot
+  ushort ref[NSLOT];           // PTEs holding each slot
+  uint outs;                   // Pages swapped out
+  uint ins;                    // Pages swapped in
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.buf.lock, "swapio");
+  swap.buf.dev = SWAPDEV;
+  if(idepresent(SWAPDEV))
+    swap.nslot = NSLOT;
+}
+
+// Serialize swap I/O and the page table updates around it.
+void
+swaplock(void)
+{
+  acquiresleep(&swap.buf.lock);
+}
+
+void
+swapunlock(void)
+{
+  releasesleep(&swap.buf.lock);
+}
+
+// Read or write the page at mem from or to slot.
+// Caller must hold swaplock().
+static void
+swaprw(char *mem, uint slot, int write)
+{
+  int i;
+
+  for(i = 0; i < PGSIZE/BSIZE; i++){
+    swap.buf.blockno = slot*(PGSIZE/BSIZE) + i;
+    if(write){
+      memmove(swap.buf.data, mem + i*BSIZE, BSIZE);
+      swap.buf.flags = B_DIRTY;
+      iderw(&swap.buf);
+    } else {
+      swap.buf.flags = 0;
+      iderw(&swap.buf);
+      memmove(mem + i*BSIZE, swap.buf.data, BSIZE);
+    }
+  }
+}
+
+// Read slot into the page at mem.  Caller must hold swaplock().
+void
+swapread(char *mem, uint slot)
+{
+  swaprw(mem, slot, 0);
+  acquire(&swap.lock);
+  swap.ins++;
+  release(&swap.lock);
+}
+
+// Allocate a slot, held by one PTE.  Returns -1 if swap is full.
+int
+swapalloc(void)
+{
+  int i, slot;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    slot = (swap.hint + i) % swap.nslot;
+    if(swap.ref[slot] == 0){
+      swap.ref[slot] = 1;
+      swap.nused++;
+      swap.hint = slot + 1;
+      release(&swap.lock);
+      return slot;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Add a PTE holding slot, as fork() makes.
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Drop a PTE holding slot.  The last one frees it.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+// Write up to NSWAPBATCH pages that were not used recently to
+// the swap disk and free them.  Returns the number freed.
+static int
+swapout(void)
+{
+  char *page[NSWAPBATCH];
+  uint slot[NSWAPBATCH];
+  int i, n;
+
+  if(swap.nslot == 0)
+    return 0;
+  swaplock();
+  n = swapscan(page, slot, NSWAPBATCH);
+  for(i = 0; i < n; i++){
+    swaprw(page[i], slot[i], 1);
+    kfree(page[i]);
+  }
+  swapunlock();
+
+  acquire(&swap.lock);
+  swap.outs += n;
+  release(&swap.lock);
+  return n;
+}
+
+// Allocate a page for user memory, zeroed if zero is set.
+// If free memory is low, swap out pages first, keeping
+// NSWAPRESERVE pages for the kernel's own allocations, which
+// cannot wait for the disk.  Returns 0 if memory is exhausted.
+// Must not be called while holding a spinlock.
+char*
+ualloc(int zero)
+{
+  while(kfreecount() < NSWAPRESERVE && swapout() > 0)
+    ;
+  return zero ? kalloc_zeroed() : kalloc();
+}
+
+// Print swap counters.
+void
+swapstat(void)
+{
+  cprintf("swap: %d of %d pages used, %d swapped out, %d swapped in\n",
+          swap.nused, swap.nslot, swap.outs, swap.ins);
+}
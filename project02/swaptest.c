@@ -0,0 +1,77 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define PGSIZE 4096
+
+// Memory pressure test: children together touch more memory than
+// the machine has, so some of it must go to the swap disk, and
+// each checks that its pages come back intact.
+// Usage: swaptest [children [MB each]]
+int main(int argc, char *argv[])
+{
+  int nchild, mb, npage, i, j, pass, pid, fd[2], ok;
+  int *page, start;
+  char *heap, c;
+
+  nchild = argc > 1 ? atoi(argv[1]) : 4;
+  mb = argc > 2 ? atoi(argv[2]) : 64;
+  npage = mb * 1024 * 1024 / PGSIZE;
+
+  printf(1, "Swap test start: %d children touching %d MB each\n", nchild, mb);
+  if (pipe(fd) < 0) {
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  start = uptime();
+
+  for (i = 0; i < nchild; i++) {
+    if ((pid = fork()) < 0) {
+      printf(1, "fork failed\n");
+      break;
+    }
+    if (pid == 0) {
+      close(fd[0]);
+      if ((heap = sbrk(mb * 1024 * 1024)) == (char*)-1) {
+        printf(1, "child %d: sbrk failed\n", i);
+        exit();
+      }
+      // Mark both ends of each page, then check them twice:
+      // by then the pages of the other children have pushed
+      // ours out to swap and back.
+      pid = getpid();
+      for (j = 0; j < npage; j++) {
+        page = (int*)(heap + j * PGSIZE);
+        page[0] = pid ^ j;
+        page[PGSIZE/sizeof(int) - 1] = ~(pid ^ j);
+      }
+      for (pass = 0; pass < 2; pass++) {
+        for (j = 0; j < npage; j++) {
+          page = (int*)(heap + j * PGSIZE);
+          if (page[0] != (pid ^ j) ||
+              page[PGSIZE/sizeof(int) - 1] != ~(pid ^ j)) {
+            printf(1, "Test failed: child %d page %d corrupt\n", i, j);
+            exit();
+          }
+        }
+      }
+      write(fd[1], "k", 1);
+      exit();
+    }
+  }
+  close(fd[1]);
+
+  ok = 0;
+  while (read(fd[0], &c, 1) == 1)
+    ok++;
+  while (wait() >= 0)
+    ;
+
+  printf(1, "%d of %d children ok in %d ticks\n", ok, nchild, uptime() - start);
+  procdump2();
+  if (ok == nchild)
+    printf(1, "Swap test ok\n");
+  else
+    printf(1, "Test failed\n");
+  exit();
+}
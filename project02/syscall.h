@@ -25,4 +25,8 @@
 #define SYS_thread_create  24
 #define SYS_thread_exit    25
 #define SYS_thread_join    26
-#define SYS_procdump2      27
\ No newline at end of file
+#define SYS_procdump2      27
+#define SYS_settls         28
+#define SYS_spawn          29
+#define SYS_mmap           30
+#define SYS_munmap         31
@@ -73,7 +73,8 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argwritable(p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -109,7 +110,8 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0 ||
+     argwritable((char*)st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
@@ -447,6 +449,35 @@ sys_exec2(void)
   return exec2(path, argv, stacksize);
 }
 
+int
+sys_spawn(void)
+{
+  char *path, *argv[MAXARG];
+  int i, *fdmap;
+  uint uargv, uarg, ufdmap;
+
+  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0 || argint(2, (int*)&ufdmap) < 0){
+    return -1;
+  }
+  fdmap = 0;
+  if(ufdmap != 0 && argptr(2, (char**)&fdmap, NSPAWNFD*sizeof(int)) < 0)
+    return -1;
+  memset(argv, 0, sizeof(argv));
+  for(i=0;; i++){
+    if(i >= NELEM(argv))
+      return -1;
+    if(fetchint(uargv+4*i, (int*)&uarg) < 0)
+      return -1;
+    if(uarg == 0){
+      argv[i] = 0;
+      break;
+    }
+    if(fetchstr(uarg, &argv[i]) < 0)
+      return -1;
+  }
+  return spawn(path, argv, fdmap);
+}
+
 int
 sys_pipe(void)
 {
@@ -454,7 +485,11 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0 ||
+     argwritable((char*)fd, 2*sizeof(fd[0])) < 0)
+    return -1;
+  // The pipe buffer counts against the memory limit.
+  if(memcheck(myproc(), 1) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
@@ -468,5 +503,6 @@ sys_pipe(void)
   }
   fd[0] = fd0;
   fd[1] = fd1;
+  memcharge(myproc(), 0);
   return 0;
 }
@@ -56,6 +56,30 @@ sys_sbrk(void)
   return addr;
 }
 
+int
+sys_mmap(void)
+{
+  int addr, len, prot, flags, fd, off;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(4, &fd) < 0 || argint(5, &off) < 0)
+    return -1;
+  // Only anonymous memory, placed by the kernel.
+  if(addr != 0 || fd != -1 || off != 0)
+    return -1;
+  return mmap(len, prot, flags);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
 int
 sys_sleep(void)
 {
@@ -118,7 +142,9 @@ sys_thread_create(void)
   void *(*start_routine)(void*);
   void *arg;
 
-  if(argint(0, (int *)&thread) < 0 || argint(1, (int *)&start_routine) < 0 || argint(2, (int *)&arg))
+  if(argptr(0, (char **)&thread, sizeof(*thread)) < 0 || argint(1, (int *)&start_routine) < 0 || argint(2, (int *)&arg))
+    return -1;
+  if(argwritable((char *)thread, sizeof(*thread)) < 0)
     return -1;
   
   return thread_create(thread, start_routine, arg);
@@ -143,8 +169,26 @@ sys_thread_join(void)
   thread_t thread;
   void **retval;
 
-  if(argint(0, (int *)&thread) < 0 || argint(1, (int *)&retval))
+  if(argint(0, (int *)&thread) < 0 || argptr(1, (char **)&retval, sizeof(*retval)) < 0)
+    return -1;
+  if(argwritable((char *)retval, sizeof(*retval)) < 0)
     return -1;
   
   return thread_join(thread, retval);
-}
\ No newline at end of file
+}
+
+int
+sys_settls(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+
+  if(settls(myproc(), (uint)addr) < 0)
+    return -1;
+
+  // Reload the TLS descriptor of this cpu.
+  switchuvm(myproc());
+  return 0;
+}
@@ -0,0 +1,62 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+#define NUM_THREAD 5
+
+thread_t thread[NUM_THREAD];
+
+void failed()
+{
+  printf(1, "Test failed!\n");
+  exit();
+}
+
+void *thread_main(void *arg)
+{
+  int val = (int)arg;
+  int *tls = gettls();
+
+  if (tls == 0 || tls[0] != (int)tls) {
+    printf(1, "Thread %d has no TLS block\n", val);
+    failed();
+  }
+  tls[1] = val;
+  sleep(50);
+  if (((int *)gettls())[1] != val) {
+    printf(1, "Thread %d TLS was overwritten\n", val);
+    failed();
+  }
+  thread_exit(arg);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int i;
+  void *retval;
+  int *block;
+
+  printf(1, "Thread TLS test start\n");
+  for (i = 0; i < NUM_THREAD; i++) {
+    if (thread_create(&thread[i], thread_main, (void *)i) != 0) {
+      printf(1, "Thread create error\n");
+      failed();
+    }
+  }
+  for (i = 0; i < NUM_THREAD; i++) {
+    if (thread_join(thread[i], &retval) != 0 || (int)retval != i) {
+      printf(1, "Thread join error\n");
+      failed();
+    }
+  }
+
+  block = malloc(TLSSIZE);
+  if (settls(block) != 0 || gettls() != block) {
+    printf(1, "settls error\n");
+    failed();
+  }
+  printf(1, "Thread TLS test success\n");
+  exit();
+}
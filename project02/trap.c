@@ -40,7 +40,9 @@ trap(struct trapframe *tf)
     if(myproc()->killed)
       exit();
     myproc()->tf = tf;
+    myproc()->insyscall = 1;
     syscall();
+    myproc()->insyscall = 0;
     if(myproc()->killed)
       exit();
     return;
@@ -57,11 +59,16 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
-    ideintr();
+    ideintr(0);
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE+1:
-    // Bochs generates spurious IDE1 interrupts.
+    // Bochs generates spurious IDE1 interrupts; real ones
+    // come only from the swap disk, if there is one.
+    if(idepresent(SWAPDEV)){
+      ideintr(1);
+      lapiceoi();
+    }
     break;
   case T_IRQ0 + IRQ_KBD:
     kbdintr();
@@ -71,6 +78,10 @@ trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  case T_TLBFLUSH:
+    tlbintr();
+    lapiceoi();
+    break;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
@@ -79,6 +90,14 @@ trap(struct trapframe *tf)
     break;
 
   //PAGEBREAK: 13
+  case T_PGFLT:
+    // A write to a page shared copy-on-write, or the first
+    // touch of program text or heap that is only reserved.
+    if(myproc() && (tf->err & FEC_WR) && cowfault(myproc()->pgdir, rcr2()) == 0)
+      break;
+    if(myproc() && !(tf->err & FEC_PR) && lazyfault(myproc(), rcr2()) == 0)
+      break;
+    // Otherwise it is an ordinary bad access; fall through.
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
@@ -104,3 +104,15 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// Return the thread-local storage block of the calling thread.
+// The kernel keeps a pointer to the block in its first word,
+// so this needs no system call.
+void*
+gettls(void)
+{
+  void *tls;
+
+  asm volatile("movl %%gs:0, %0" : "=r" (tls));
+  return tls;
+}
@@ -29,6 +29,10 @@ int setmemorylimit(int, int);
 int thread_create(thread_t*, void*(*)(void*), void*);
 void thread_exit(void*);
 int thread_join(thread_t, void**);
+int settls(void*);
+int spawn(char*, char**, int*);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -43,3 +47,4 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+void* gettls(void);
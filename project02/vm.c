@@ -6,10 +6,57 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+
+#define NTLBBATCH 32  // max pages invalidated per shootdown round
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+// TLB shootdown state.  Only one shootdown is in flight at a time;
+// the cpu that set busy owns pgdir, va and n until it clears busy.
+static struct {
+  volatile uint busy;
+  pde_t *pgdir;
+  uint *va;
+  int n;
+  uint rounds;    // shootdowns that interrupted another cpu
+  uint ipis;      // IPIs sent
+  uint pages;     // pages invalidated
+} tlbshoot;
+
+// Serializes page faults, since threads share a pgdir.
+struct spinlock faultlock;
+
+// MAP_HUGETLB statistics.
+static struct {
+  uint maps;      // 4 MB pages mapped on fault
+  uint copies;    // 4 MB pages copied by fork
+  uint fallbacks; // faults that found no free 4 MB of memory
+} bigstat;
+
+// Pages of read-only program segments, shared by every process
+// running the same file.  Each cached page holds one reference
+// of its own, so it outlives the processes that mapped it.
+struct {
+  struct spinlock lock;
+  struct {
+    uint dev;
+    uint inum;
+    uint off;                  // Offset in the file
+    uint n;                    // Bytes from the file; the rest is zero
+    char *page;
+  } ent[NPCACHE];
+  int hand;                    // Next entry to replace
+  uint hits;
+  uint misses;
+} pcache;
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -31,7 +78,8 @@ seginit(void)
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page table pages.
+// create any required page table pages.  If va lies in a
+// 4 MB page, return the PTE_PS pde itself.
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
@@ -39,13 +87,14 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return pde;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -79,6 +128,30 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
   return 0;
 }
 
+// Like mappages(), but use 4 MB pages where va and pa are
+// aligned for them.  Only for the kernel part of a page table.
+static int
+kmappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
+{
+  uint a, n;
+
+  a = (uint)va;
+  while(size > 0){
+    if(a % BIGPGSIZE == 0 && pa % BIGPGSIZE == 0 && size >= BIGPGSIZE){
+      pgdir[PDX(a)] = pa | perm | PTE_P | PTE_PS;
+      n = BIGPGSIZE;
+    } else {
+      if(mappages(pgdir, (void*)a, PGSIZE, pa, perm) < 0)
+        return -1;
+      n = PGSIZE;
+    }
+    a += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
@@ -99,6 +172,10 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 // The kernel allocates physical memory for its heap and for user memory
 // between V2P(end) and the end of physical memory (PHYSTOP)
 // (directly addressable from end..P2V(PHYSTOP)).
+//
+// Kernel mappings use 4 MB pages wherever they are aligned for
+// them, which saves TLB entries and the page table pages that
+// each process would otherwise need to map physical memory.
 
 // This table defines the kernel's mappings, which are present in
 // every process's page table.
@@ -121,14 +198,13 @@ setupkvm(void)
   pde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kalloc_zeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
+    if(kmappages(pgdir, k->virt, k->phys_end - k->phys_start,
+                 (uint)k->phys_start, k->perm) < 0) {
       freevm(pgdir);
       return 0;
     }
@@ -141,6 +217,8 @@ void
 kvmalloc(void)
 {
   kpgdir = setupkvm();
+  initlock(&faultlock, "fault");
+  initlock(&pcache.lock, "pcache");
   switchkvm();
 }
 
@@ -173,10 +251,30 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
+  // Each thread's %gs selects SEG_UTLS, so the descriptor must be
+  // rewritten for the thread that is about to run.  %gs is reloaded
+  // from the trap frame in trapret.  The limit is in bytes, so that
+  // %gs reaches only the TLSSIZE-byte block.
+  mycpu()->gdt[SEG_UTLS] = SEG16(STA_W, p->tls, TLSSIZE-1, DPL_USER);
+  mycpu()->pgdir = p->pgdir;
   lcr3(V2P(p->pgdir));  // switch to process's address space
   popcli();
 }
 
+// Install the TLSSIZE bytes at va as the thread-local storage
+// block of p.  The first word of the block points at the block
+// itself, so user code can find it with a single %gs:0 load.
+int
+settls(struct proc *p, uint va)
+{
+  if(va % sizeof(uint) != 0 || va >= p->sz || va + TLSSIZE > p->sz)
+    return -1;
+  if(copyout(p->pgdir, va, &va, sizeof(va)) < 0)
+    return -1;
+  p->tls = va;
+  return 0;
+}
+
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
 void
@@ -186,36 +284,11 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
-{
-  uint i, pa, n;
-  pte_t *pte;
-
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
-  }
-  return 0;
-}
-
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int
@@ -231,13 +304,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = ualloc(1);
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -248,21 +320,141 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+//PAGEBREAK!
+// Invalidate va[0..n) of pgdir in the TLB of this cpu,
+// if pgdir is the page table it is running on.
+// If va is 0, flush the whole TLB instead.
+// Must be called with interrupts disabled.
+static void
+tlbflushlocal(pde_t *pgdir, uint *va, int n)
+{
+  int i;
+
+  if(mycpu()->pgdir != pgdir)
+    return;
+  if(va == 0){
+    lcr3(rcr3());
+    return;
+  }
+  for(i = 0; i < n; i++)
+    invlpg((void*)va[i]);
+}
+
+// Answer a shootdown aimed at this cpu, if there is one.
+// Must be called with interrupts disabled.  acquire() calls
+// this while spinning, so a cpu waiting for a lock held by
+// the initiator does not deadlock the shootdown.
+void
+tlbserve(void)
+{
+  struct cpu *c = mycpu();
+
+  if(!c->tlbpending)
+    return;
+  tlbflushlocal(tlbshoot.pgdir, tlbshoot.va, tlbshoot.n);
+  c->tlbpending = 0;
+}
+
+// TLB shootdown IPI handler.
+void
+tlbintr(void)
+{
+  tlbserve();
+}
+
+// Invalidate va[0..n) of pgdir on every cpu that is running
+// on pgdir, and wait until all of them have done so.
+// If va is 0, flush the whole TLB of those cpus.
+// The PTEs must already be updated.
+static void
+tlbshootdown(pde_t *pgdir, uint *va, int n)
+{
+  struct cpu *c;
+  int sent;
+
+  if(va != 0 && n == 0)
+    return;
+
+  pushcli();
+  // Keep answering other shootdowns while waiting for our turn,
+  // since their initiators spin with interrupts disabled.
+  while(xchg(&tlbshoot.busy, 1) != 0)
+    tlbserve();
+  tlbshoot.pgdir = pgdir;
+  tlbshoot.va = va;
+  tlbshoot.n = n;
+
+  tlbflushlocal(pgdir, va, n);
+  sent = 0;
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(c == mycpu() || c->pgdir != pgdir)
+      continue;
+    c->tlbpending = 1;
+    lapicipi(c->apicid, T_TLBFLUSH);
+    sent++;
+  }
+  for(c = cpus; c < cpus+ncpu; c++)
+    while(c->tlbpending)
+      ;
+
+  if(sent)
+    tlbshoot.rounds++;
+  tlbshoot.ipis += sent;
+  if(va != 0)
+    tlbshoot.pages += n;
+  xchg(&tlbshoot.busy, 0);
+  popcli();
+}
+
+// Print TLB shootdown counters.
+void
+tlbstat(void)
+{
+  cprintf("tlb shootdown: %d rounds, %d ipis, %d pages\n",
+          tlbshoot.rounds, tlbshoot.ipis, tlbshoot.pages);
+}
+
+// Shoot down va[0..n) of pgdir, then free the pages
+// that used to be mapped there.
+static void
+tlbfree(pde_t *pgdir, uint *va, char **page, int n)
+{
+  tlbshootdown(pgdir, va, n);
+  while(n-- > 0)
+    kfree(page[n]);
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
+// Freed pages are gathered into batches so that other cpus
+// running on pgdir are interrupted once per batch.  Pages that
+// are swapped out just give up their swap slots.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
   pte_t *pte;
   uint a, pa;
+  uint va[NTLBBATCH];
+  char *page[NTLBBATCH];
+  int n;
 
   if(newsz >= oldsz)
     return oldsz;
 
+  n = 0;
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS){
+      // A 4 MB page; munmap() only removes whole ones.
+      pa = PTE_ADDR(pgdir[PDX(a)]);
+      pgdir[PDX(a)] = 0;
+      tlbshootdown(pgdir, &a, 1);
+      kfreebig(P2V(pa));
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -270,11 +462,19 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
-      char *v = P2V(pa);
-      kfree(v);
+      *pte = 0;
+      va[n] = a;
+      page[n] = P2V(pa);
+      if(++n == NTLBBATCH){
+        tlbfree(pgdir, va, page, n);
+        n = 0;
+      }
+    } else if(*pte & PTE_SWAP){
+      swapfree(PTE_ADDR(*pte) >> PTXSHIFT);
       *pte = 0;
     }
   }
+  tlbfree(pgdir, va, page, n);
   return newsz;
 }
 
@@ -289,7 +489,7 @@ freevm(pde_t *pgdir)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
   for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){
+    if((pgdir[i] & (PTE_P|PTE_PS)) == PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
     }
@@ -297,6 +497,42 @@ freevm(pde_t *pgdir)
   kfree((char*)pgdir);
 }
 
+// Return the number of pages mapped in [start, end) of pgdir.
+// A 4 MB page counts as the 1024 pages it is made of.
+int
+upages(pde_t *pgdir, uint start, uint end)
+{
+  pte_t *pte;
+  uint a;
+  int n;
+
+  n = 0;
+  for(a = PGROUNDDOWN(start); a < end; a += PGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS){
+      n += NPTENTRIES;
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+    } else if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0)
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+    else if(*pte & PTE_P)
+      n++;
+  }
+  return n;
+}
+
+// Return the number of pages pgdir itself takes: the page
+// directory and its page table pages.
+int
+ptpages(pde_t *pgdir)
+{
+  int i, n;
+
+  n = 1;
+  for(i = 0; i < NPDENTRIES; i++)
+    if((pgdir[i] & (PTE_P|PTE_PS)) == PTE_P)
+      n++;
+  return n;
+}
+
 // Clear PTE_U on a page. Used to create an inaccessible
 // page beneath the user stack.
 void
@@ -310,40 +546,603 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
-// Given a parent process's page table, create a copy
-// of it for a child.
-pde_t*
-copyuvm(pde_t *pgdir, uint sz)
+// Give d a private copy of the 4 MB page that pde maps at va,
+// in small pages if no 4 MB of free memory is left.
+static int
+copybig(pde_t *d, uint va, pde_t pde)
 {
-  pde_t *d;
-  pte_t *pte;
-  uint pa, i, flags;
-  char *mem;
+  char *src, *mem;
+  uint i;
 
-  if((d = setupkvm()) == 0)
+  src = P2V(PTE_ADDR(pde));
+  if((mem = kallocbig()) != 0){
+    memmove(mem, src, BIGPGSIZE);
+    d[PDX(va)] = V2P(mem) | PTE_FLAGS(pde);
+    bigstat.copies++;
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
+  }
+  for(i = 0; i < BIGPGSIZE; i += PGSIZE){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, src + i, PGSIZE);
+    if(mappages(d, (char*)va + i, PGSIZE, V2P(mem),
+                PTE_FLAGS(pde) & ~PTE_PS) < 0){
+      kfree(mem);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Map the pages of [start, end) of pgdir into d as well.
+// Unless shared is set, writable pages become copy-on-write
+// in both page tables.  4 MB pages are copied at once.
+// Swapped-out pages share their swap slot, and each page
+// table reads its own copy back.
+static int
+copyrange(pde_t *pgdir, pde_t *d, uint start, uint end, int shared)
+{
+  pte_t *pte, *dpte;
+  uint pa, i, flags;
+
+  for(i = start; i < end; i += PGSIZE){
+    if(pgdir[PDX(i)] & PTE_PS){
+      if(copybig(d, i, pgdir[PDX(i)]) < 0)
+        return -1;
+      i += BIGPGSIZE - PGSIZE;
+      continue;
+    }
+    // Pages that sbrk() reserved but nobody touched
+    // stay unmapped in the child too.
     if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+      continue;
+    if(*pte & PTE_SWAP){
+      if((dpte = walkpgdir(d, (void *) i, 1)) == 0)
+        return -1;
+      *dpte = *pte;
+      swapdup(PTE_ADDR(*pte) >> PTXSHIFT);
+      continue;
+    }
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
+    if(!shared && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
-      goto bad;
-    }
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
+      return -1;
+    kincref(P2V(pa));
   }
+  return 0;
+}
+
+// Given a parent process's page table, create a copy
+// of it for a child, covering [0, sz) and the mmap()
+// regions in vma.  Pages are not copied: writable pages
+// become read-only copy-on-write pages in both page tables,
+// and are copied by cowfault() on the first write.  Pages
+// of MAP_SHARED regions stay shared and writable.
+pde_t*
+copyuvm(pde_t *pgdir, uint sz, struct vma *vma)
+{
+  pde_t *d;
+  struct vma *v;
+
+  if((d = setupkvm()) == 0)
+    return 0;
+  if(copyrange(pgdir, d, 0, sz, 0) < 0)
+    goto bad;
+  for(v = vma; v < &vma[NVMA]; v++)
+    if(v->end && copyrange(pgdir, d, v->start, v->end,
+                           v->flags & MAP_SHARED) < 0)
+      goto bad;
+  // The parent lost write access; other threads of it
+  // may still cache the old PTEs.
+  tlbshootdown(pgdir, 0, 0);
   return d;
 
 bad:
+  tlbshootdown(pgdir, 0, 0);
   freevm(d);
   return 0;
 }
 
+// Allocate the copy for cowfault().  ualloc() may sleep to swap
+// pages out, so a fault the kernel takes while holding a spinlock
+// (piperead() storing to a user buffer under the pipe lock) takes
+// the page from kalloc()'s reserve instead.
+static char*
+cowalloc(void)
+{
+  int locked;
+
+  pushcli();
+  locked = mycpu()->ncli > 1;
+  popcli();
+  return locked ? kalloc() : ualloc(0);
+}
+
+// Give pgdir a private, writable copy of the copy-on-write
+// page at va.  If nobody else shares the page any more, just
+// make it writable again.  Returns -1 if va is not a
+// copy-on-write page or memory is exhausted.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa, flags;
+  char *mem;
+
+  if(va >= KERNBASE)
+    return -1;
+  va = PGROUNDDOWN(va);
+  mem = 0;
+
+again:
+  acquire(&faultlock);
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) == 0 || (*pte & PTE_P) == 0){
+    release(&faultlock);
+    if(mem)
+      kfree(mem);
+    return -1;
+  }
+  if((*pte & PTE_COW) == 0){
+    // Another thread got here first; the fault came
+    // from a stale TLB entry, which the fault flushed.
+    release(&faultlock);
+    if(mem)
+      kfree(mem);
+    return (*pte & PTE_W) ? 0 : -1;
+  }
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  if(kgetref(P2V(pa)) > 1){
+    if(mem == 0){
+      // ualloc() may swap, so it cannot run under faultlock.
+      release(&faultlock);
+      if((mem = cowalloc()) == 0)
+        return -1;
+      goto again;
+    }
+    memmove(mem, P2V(pa), PGSIZE);
+    *pte = V2P(mem) | flags;
+    kfree(P2V(pa));
+  } else {
+    *pte = pa | flags;
+    if(mem)
+      kfree(mem);
+  }
+  release(&faultlock);
+
+  tlbshootdown(pgdir, &va, 1);
+  return 0;
+}
+
+// Give pgdir private copies of the copy-on-write pages in
+// [va, va+n), which the kernel is about to store into for a
+// system call, so that the store cannot fault and need memory
+// the fault could not get.  Returns -1 if memory is exhausted.
+int
+cowbreak(pde_t *pgdir, uint va, uint n)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    pte = walkpgdir(pgdir, (void*)a, 0);
+    if(pte && (*pte & (PTE_P|PTE_COW)) == (PTE_P|PTE_COW) &&
+       cowfault(pgdir, a) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+//PAGEBREAK!
+// Read n bytes at off of the program file ip into dst.
+static int
+readprog(struct inode *ip, char *dst, uint off, uint n)
+{
+  int r;
+
+  ilock(ip);
+  r = readi(ip, dst, off, n);
+  iunlock(ip);
+  return r == n ? 0 : -1;
+}
+
+// Return a page holding n bytes at off of ip followed by zeros,
+// from the page cache if possible.  The caller gets a reference
+// of its own.  Returns 0 if memory is exhausted or the read fails.
+static char*
+pcget(struct inode *ip, uint off, uint n)
+{
+  int i;
+  char *mem;
+
+  acquire(&pcache.lock);
+  for(i = 0; i < NPCACHE; i++){
+    if(pcache.ent[i].page && pcache.ent[i].dev == ip->dev &&
+       pcache.ent[i].inum == ip->inum && pcache.ent[i].off == off &&
+       pcache.ent[i].n == n){
+      mem = pcache.ent[i].page;
+      kincref(mem);
+      pcache.hits++;
+      release(&pcache.lock);
+      return mem;
+    }
+  }
+  pcache.misses++;
+  release(&pcache.lock);
+
+  if((mem = ualloc(1)) == 0)
+    return 0;
+  if(readprog(ip, mem, off, n) < 0){
+    kfree(mem);
+    return 0;
+  }
+
+  acquire(&pcache.lock);
+  i = pcache.hand;
+  pcache.hand = (pcache.hand + 1) % NPCACHE;
+  if(pcache.ent[i].page)
+    kfree(pcache.ent[i].page);
+  pcache.ent[i].dev = ip->dev;
+  pcache.ent[i].inum = ip->inum;
+  pcache.ent[i].off = off;
+  pcache.ent[i].n = n;
+  pcache.ent[i].page = mem;
+  kincref(mem);
+  release(&pcache.lock);
+  return mem;
+}
+
+// Drop the cached pages of ip, whose contents are changing.
+// Processes that already mapped them keep their copies.
+void
+pcinval(struct inode *ip)
+{
+  int i;
+
+  acquire(&pcache.lock);
+  for(i = 0; i < NPCACHE; i++){
+    if(pcache.ent[i].page && pcache.ent[i].dev == ip->dev &&
+       pcache.ent[i].inum == ip->inum){
+      kfree(pcache.ent[i].page);
+      pcache.ent[i].page = 0;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Print page cache counters.
+void
+pcstat(void)
+{
+  cprintf("program page cache: %d hits, %d misses\n",
+          pcache.hits, pcache.misses);
+}
+
+// Fill the page at va from the program segments of p, which
+// exec() recorded without loading anything.  A page that lies
+// in a single read-only segment comes from the page cache and
+// is mapped copy-on-write, so writes still work but never reach
+// the shared copy.  Other pages are private.  Returns 0 if va is
+// now mapped, -1 if memory is exhausted or the read fails.
+static int
+execfault(struct proc *p, uint va)
+{
+  struct execseg *sg, *only;
+  uint start, end, n;
+  int nover, perm;
+  char *mem;
+  pte_t *pte;
+
+  nover = 0;
+  only = 0;
+  for(sg = p->seg; sg < &p->seg[p->nseg]; sg++){
+    if(sg->va < va + PGSIZE && sg->va + sg->memsz > va){
+      nover++;
+      only = sg;
+    }
+  }
+  if(memcheck(p, 1) < 0)
+    return -1;
+  if(nover == 1 && !only->writable && va >= only->va){
+    n = 0;
+    if(only->filesz > va - only->va)
+      n = only->filesz - (va - only->va);
+    if(n > PGSIZE)
+      n = PGSIZE;
+    if((mem = pcget(p->exe, only->off + (va - only->va), n)) == 0)
+      return -1;
+    perm = PTE_U|PTE_COW;
+  } else {
+    if((mem = ualloc(1)) == 0)
+      return -1;
+    for(sg = p->seg; sg < &p->seg[p->nseg]; sg++){
+      start = va > sg->va ? va : sg->va;
+      end = sg->va + sg->filesz;
+      if(end > va + PGSIZE)
+        end = va + PGSIZE;
+      if(start < end &&
+         readprog(p->exe, mem + (start - va), sg->off + (start - sg->va),
+                  end - start) < 0){
+        kfree(mem);
+        return -1;
+      }
+    }
+    perm = PTE_W|PTE_U;
+  }
+
+  acquire(&faultlock);
+  pte = walkpgdir(p->pgdir, (void*)va, 0);
+  if(pte && (*pte & (PTE_P|PTE_SWAP))){
+    // Another thread mapped it first.
+    release(&faultlock);
+    kfree(mem);
+    return 0;
+  }
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    release(&faultlock);
+    kfree(mem);
+    return -1;
+  }
+  release(&faultlock);
+  memcharge(p, 1);
+  return 0;
+}
+
+// Return the mmap() region of p holding va, or 0.
+struct vma*
+findvma(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end && v->start <= va && va < v->end)
+      return v;
+  return 0;
+}
+
+// Return the end of the part of p's address space that holds
+// va: sz for the program and heap, or the end of an mmap()
+// region.  Returns 0 if va is not a user address of p.
+uint
+uvmend(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  if(va < p->sz)
+    return p->sz;
+  if((v = findvma(p, va)) != 0)
+    return v->end;
+  return 0;
+}
+
+// Map zeroed pages with permissions perm over [start, end) of
+// pgdir.  Returns -1 if memory is exhausted; the pages mapped
+// so far are left for the caller to free.
+int
+mapzero(pde_t *pgdir, uint start, uint end, int perm)
+{
+  char *mem;
+  uint a;
+
+  for(a = start; a < end; a += PGSIZE){
+    if((mem = ualloc(1)) == 0)
+      return -1;
+    if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), perm) < 0){
+      kfree(mem);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Map a zeroed 4 MB page over the 4 MB around va of p, for
+// a MAP_HUGETLB region.  Returns -1 if part of it is mapped
+// with small pages already or no 4 MB of free memory is left,
+// and the caller should map a small page instead.
+static int
+bigfault(struct proc *p, uint va, int perm)
+{
+  pde_t *pde;
+  char *mem;
+
+  pde = &p->pgdir[PDX(va)];
+  if(*pde & PTE_P)
+    return *pde & PTE_PS ? 0 : -1;
+  if(memcheck(p, NPTENTRIES) < 0)
+    return -1;
+  if((mem = kallocbig()) == 0){
+    bigstat.fallbacks++;
+    return -1;
+  }
+  memset(mem, 0, BIGPGSIZE);
+
+  acquire(&faultlock);
+  if(*pde & PTE_P){
+    // Another thread mapped it first.
+    release(&faultlock);
+    kfreebig(mem);
+    return *pde & PTE_PS ? 0 : -1;
+  }
+  *pde = V2P(mem) | perm | PTE_P | PTE_PS;
+  bigstat.maps++;
+  release(&faultlock);
+  memcharge(p, NPTENTRIES);
+  return 0;
+}
+
+// Print MAP_HUGETLB counters.
+void
+bigpgstat(void)
+{
+  cprintf("4MB user pages: %d mapped, %d copied, %d fell back to 4KB\n",
+          bigstat.maps, bigstat.copies, bigstat.fallbacks);
+}
+
+// Read the page at va of p back from the swap slot its PTE
+// holds.  Returns 0 if va is now mapped, -1 if memory is
+// exhausted.
+static int
+swapin(struct proc *p, uint va)
+{
+  pte_t *pte;
+  uint entry;
+  char *mem;
+
+  if((mem = ualloc(0)) == 0){
+    cprintf("swapin out of memory\n");
+    return -1;
+  }
+  swaplock();
+  acquire(&faultlock);
+  pte = walkpgdir(p->pgdir, (void*)va, 0);
+  entry = pte ? *pte : 0;
+  release(&faultlock);
+  if(entry & PTE_SWAP)
+    swapread(mem, PTE_ADDR(entry) >> PTXSHIFT);
+
+  acquire(&faultlock);
+  if((entry & PTE_SWAP) == 0 || *pte != entry){
+    // Another thread read it back or unmapped it first.
+    release(&faultlock);
+    swapunlock();
+    kfree(mem);
+    return lazyfault(p, va);
+  }
+  *pte = V2P(mem) | (entry & (PTE_W|PTE_U)) | PTE_P;
+  release(&faultlock);
+  swapfree(PTE_ADDR(entry) >> PTXSHIFT);
+  swapunlock();
+  memcharge(p, 1);
+  return 0;
+}
+
+// Sweep the clock hand *hand over the user pages of p, taking
+// up to n pages that were not used since the hand last passed
+// them; pages it finds with PTE_A set just lose the bit.  Only
+// private 4 KB pages are taken.  Each gets a swap slot, which
+// its PTE holds from now on.  Returns the number of pages taken,
+// with the pages and their slots in page[] and slot[], for the
+// caller to write out and free.  *hand is 0 once the sweep
+// reaches the end of p's address space.
+// The caller holds ptable.lock and makes sure that no thread
+// of p runs on another cpu or is in a system call.
+int
+clockscan(struct proc *p, uint *hand, char **page, uint *slot, int n)
+{
+  pde_t *pgdir;
+  pte_t *pte;
+  struct vma *v;
+  uint a;
+  int k, s;
+
+  pgdir = p->pgdir;
+  k = 0;
+  for(a = *hand; a < KERNBASE && k < n; a += PGSIZE){
+    if((pgdir[PDX(a)] & (PTE_P|PTE_PS)) != PTE_P){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    pte = (pte_t*)P2V(PTE_ADDR(pgdir[PDX(a)])) + PTX(a);
+    if((*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    if(kgetref(P2V(PTE_ADDR(*pte))) > 1)
+      continue;
+    if((v = findvma(p, a)) != 0 && (v->flags & MAP_SHARED))
+      continue;
+    if((s = swapalloc()) < 0)
+      break;
+    page[k] = P2V(PTE_ADDR(*pte));
+    slot[k] = s;
+    k++;
+    // The page is private now even if it is still marked
+    // copy-on-write, so it comes back plain writable.
+    *pte = (s << PTXSHIFT) | PTE_SWAP | (*pte & PTE_U) |
+           ((*pte & (PTE_W|PTE_COW)) ? PTE_W : 0);
+  }
+  *hand = a < KERNBASE ? a : 0;
+  // Only this cpu can hold the old PTEs, if p is its process.
+  if(k > 0)
+    tlbshootdown(pgdir, 0, 0);
+  return k;
+}
+
+// Map the page at va of p, which exec(), growproc() or mmap()
+// reserved but nobody has touched yet, or which was swapped
+// out.  Program pages are read from the file; heap and anonymous
+// pages are zeroed.  Returns 0 if va is now mapped, -1 if it is
+// not a user address of p or memory is exhausted.
+int
+lazyfault(struct proc *p, uint va)
+{
+  struct execseg *sg;
+  struct vma *v;
+  pde_t *pgdir;
+  pte_t *pte;
+  char *mem;
+  int perm;
+
+  if(va >= KERNBASE)
+    return -1;
+  v = 0;
+  if(va >= p->sz && (v = findvma(p, va)) == 0)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pgdir = p->pgdir;
+
+  // Fast path for pages that are already there.
+  pte = walkpgdir(pgdir, (void*)va, 0);
+  if(pte && (*pte & PTE_P))
+    return (*pte & PTE_U) ? 0 : -1;
+  if(pte && (*pte & PTE_SWAP))
+    return swapin(p, va);
+
+  perm = PTE_W|PTE_U;
+  if(v){
+    // mmap() fills shared regions when it creates them.
+    if(v->flags & MAP_SHARED)
+      return -1;
+    if((v->prot & PROT_WRITE) == 0)
+      perm = PTE_U;
+    if((v->flags & MAP_HUGETLB) && bigfault(p, va, perm) == 0)
+      return 0;
+  } else if(p->exe)
+    for(sg = p->seg; sg < &p->seg[p->nseg]; sg++)
+      if(sg->va < va + PGSIZE && sg->va + sg->memsz > va)
+        return execfault(p, va);
+
+  if(memcheck(p, 1) < 0)
+    return -1;
+  if((mem = ualloc(1)) == 0){
+    cprintf("lazyfault out of memory\n");
+    return -1;
+  }
+  acquire(&faultlock);
+  pte = walkpgdir(pgdir, (void*)va, 0);
+  if(pte && (*pte & (PTE_P|PTE_SWAP))){
+    // Another thread mapped it first.
+    release(&faultlock);
+    kfree(mem);
+    return lazyfault(p, va);
+  }
+  if(mappages(pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    release(&faultlock);
+    kfree(mem);
+    cprintf("lazyfault out of memory (2)\n");
+    return -1;
+  }
+  release(&faultlock);
+  memcharge(p, 1);
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -352,26 +1151,36 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
+  if(*pte & PTE_PS)
+    return (char*)P2V(PTE_ADDR(*pte)) + ((uint)uva & (BIGPGSIZE-1) & ~(PGSIZE-1));
   return (char*)P2V(PTE_ADDR(*pte));
 }
 
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
 // uva2ka ensures this only works for PTE_U pages.
+// Untouched heap pages of the current process are faulted in.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_COW) && cowfault(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
+    if(pa0 == 0 && myproc() && myproc()->pgdir == pgdir &&
+       lazyfault(myproc(), va0) == 0)
+      pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (va - va0);
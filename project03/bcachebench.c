@@ -0,0 +1,93 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "iostat.h"
+
+#define MAXWORKERS 8
+#define FILESIZE (8*BSIZE)  // blocks each worker reads over and over
+#define NREAD 2000        // reads of the whole file per worker
+
+char buf[FILESIZE];
+
+void
+makefile(char *name)
+{
+  int fd;
+
+  fd = open(name, O_CREATE | O_RDWR);
+  if (fd < 0 || write(fd, buf, FILESIZE) != FILESIZE) {
+    printf(1, "create %s failed\n", name);
+    exit();
+  }
+  close(fd);
+}
+
+// Read name from the start NREAD times.  Its blocks stay in
+// the buffer cache, so this measures lookups, not the disk.
+void
+readloop(char *name)
+{
+  int fd, i;
+
+  for (i = 0; i < NREAD; i++) {
+    fd = open(name, O_RDONLY);
+    if (fd < 0 || read(fd, buf, FILESIZE) != FILESIZE) {
+      printf(1, "read %s failed\n", name);
+      exit();
+    }
+    close(fd);
+  }
+}
+
+// Buffer cache scaling: 1, 2, 4 ... workers, each reading a
+// cached file of its own, so that they share nothing but the
+// buffer cache.  With per-bucket locks the total reads per tick
+// should grow with the number of cpus.
+// Usage: bcachebench [maxworkers]
+int
+main(int argc, char *argv[])
+{
+  char name[8];
+  int max, n, i, start, ticks;
+  struct iostat s0, s1;
+
+  max = argc > 1 ? atoi(argv[1]) : 4;
+  if (max > MAXWORKERS)
+    max = MAXWORKERS;
+
+  strcpy(name, "bcb0");
+  for (i = 0; i < max; i++) {
+    name[3] = '0' + i;
+    makefile(name);
+  }
+
+  iostat(&s0);
+  printf(1, "buffer cache: %d buffers\n", s0.nbuf);
+  for (n = 1; n <= max; n *= 2) {
+    iostat(&s0);
+    start = uptime();
+    for (i = 0; i < n; i++) {
+      if (fork() == 0) {
+        name[3] = '0' + i;
+        readloop(name);
+        exit();
+      }
+    }
+    for (i = 0; i < n; i++)
+      wait();
+    ticks = uptime() - start;
+    iostat(&s1);
+    printf(1, "%d workers: %d file reads in %d ticks; "
+           "%d hits, %d misses, %d lock waits\n",
+           n, n * NREAD, ticks, s1.bhits - s0.bhits,
+           s1.bmisses - s0.bmisses, s1.bwaits - s0.bwaits);
+  }
+
+  for (i = 0; i < max; i++) {
+    name[3] = '0' + i;
+    unlink(name);
+  }
+  exit();
+}
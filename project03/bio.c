@@ -1,7 +1,13 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
-// cached copies of disk block contents.  Caching disk blocks
+// The buffer cache is a hash table of buf structures holding
+// cached copies of disk block contents.  The hash chains are
+// spread over a smaller number of buckets, each with its own
+// lock, so that lookups of different blocks from different
+// cpus seldom contend; unused buffers are also on an LRU list,
+// from which a miss recycles the oldest.  The buffers and
+// their data live in pages from kalloc(), as many as a share of
+// the memory free at boot pays for.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
@@ -21,75 +27,280 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
+
+#define NBUCKET 61    // bucket locks
+#define NHASH   4099  // hash chains; prime, so blocks spread evenly
+
+#define BHASH(dev, blockno) (((dev) * 31 + (blockno)) % NHASH)
+#define BUCKET(h) (&bcache.bucket[(h) % NBUCKET])
+
+// A bucket's lock protects the dev, blockno, refcnt and hash
+// chain of the buffers on its chains, and its own counters.
+struct bucket {
+  struct spinlock lock;
+  uint hits;
+  uint misses;
+  uint aheads;                 // Blocks read ahead
+  uint waits;                  // Times the lock was found held
+};
 
 struct {
+  // Serializes recycling, which moves a buffer between chains.
   struct spinlock lock;
-  struct buf buf[NBUF];
+  // Protects the LRU list and nwait.  Taken after any bucket lock.
+  struct spinlock lrulock;
+  int nbuf;
+  int nwait;                   // bget() calls waiting for a buffer
+  struct buf *hash[NHASH];     // Chains through hnext
+  struct bucket bucket[NBUCKET];
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+  // Linked list of buffers with refcnt == 0, through prev/next.
+  // lru.next is most recently used.
+  struct buf lru;
 } bcache;
 
+// Add a page of buffers, with pages for their data, to the
+// cache.  They are unused, each named as a different block of
+// device 0, which holds no file system, to spread them over the
+// hash chains.  Returns -1 if memory is exhausted.
+static int
+bgrow(void)
+{
+  struct buf *b, *end;
+  uchar *data;
+  uint h;
+
+  if((b = (struct buf*)kalloc()) == 0)
+    return -1;
+  memset(b, 0, PGSIZE);
+  end = b + PGSIZE/sizeof(struct buf);
+  data = 0;
+  for(; b < end; b++){
+    if(data == 0 && (data = (uchar*)kalloc()) == 0)
+      return -1;
+    b->data = data;
+    data += BSIZE;
+    if((uint)data % PGSIZE == 0)
+      data = 0;
+    initsleeplock(&b->lock, "buffer");
+    b->blockno = bcache.nbuf;
+    h = BHASH(0, b->blockno);
+    b->next = bcache.lru.next;
+    b->prev = &bcache.lru;
+    bcache.lru.next->prev = b;
+    bcache.lru.next = b;
+    b->hnext = bcache.hash[h];
+    bcache.hash[h] = b;
+    bcache.nbuf++;
+  }
+  return 0;
+}
+
+// Called after kinit2(), to size the cache from free memory:
+// 1/BCACHEFRAC of it, but at least NBUF buffers, and no more
+// than the file system has blocks.
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *bk;
+  int n;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.lrulock, "bcache.lru");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
 
 //PAGEBREAK!
   // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
+  bcache.lru.prev = &bcache.lru;
+  bcache.lru.next = &bcache.lru;
+  n = kfreecount() / BCACHEFRAC * PGSIZE / (sizeof(struct buf) + BSIZE);
+  if(n < NBUF)
+    n = NBUF;
+  if(n > FSSIZE)
+    n = FSSIZE;
+  while(bcache.nbuf < n && bgrow() == 0)
+    ;
+  if(bcache.nbuf < NBUF)
+    panic("binit");
+}
+
+// Lock bk, counting the times another cpu had it.
+static void
+bucketlock(struct bucket *bk)
+{
+  int busy;
+
+  busy = bk->lock.locked;
+  acquire(&bk->lock);
+  if(busy)
+    bk->waits++;
+}
+
+// Take b off the LRU list.  Caller holds b's bucket lock.
+static void
+lruunlink(struct buf *b)
+{
+  acquire(&bcache.lrulock);
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  release(&bcache.lrulock);
+}
+
+// Look for block blockno of dev on chain h, whose bucket caller
+// has locked.
+static struct buf*
+bfind(uint h, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bcache.hash[h]; b; b = b->hnext)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Take a reference to b.  Caller holds b's bucket lock.
+static void
+bhold(struct buf *b)
+{
+  if(b->refcnt++ == 0)
+    lruunlink(b);
+}
+
+// Return the least recently used buffer that can be recycled,
+// or 0 if there is none.  Caller holds bcache.lrulock.
+static struct buf*
+lruvictim(void)
+{
+  struct buf *b;
+
+  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
+  // because log.c has modified it but not yet committed it.
+  for(b = bcache.lru.prev; b != &bcache.lru; b = b->prev)
+    if((b->flags & B_DIRTY) == 0)
+      return b;
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
+// If not found, allocate a buffer, waiting for one to
+// be released if all are in use.
 // In either case, return locked buffer.
+// For read-ahead, which must not wait, return 0 instead
+// if the block is cached already or no buffer is free.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int ahead)
 {
-  struct buf *b;
+  struct buf *b, **pp;
+  struct bucket *bk, *old;
+  uint h, oh;
 
-  acquire(&bcache.lock);
+  h = BHASH(dev, blockno);
+  bk = BUCKET(h);
+  bucketlock(bk);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  if((b = bfind(h, dev, blockno)) != 0){
+    if(ahead){
+      release(&bk->lock);
+      return 0;
     }
+    bhold(b);
+    bk->hits++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
+  // Not cached; recycle the least recently used buffer.
+  // Only one cpu at a time does this, so once it has
+  // checked that the block is still missing, no one else
+  // can add it.
+  for(;;){
+    acquire(&bcache.lock);
+    bucketlock(bk);
+    if((b = bfind(h, dev, blockno)) != 0){
+      if(ahead){
+        release(&bk->lock);
+        release(&bcache.lock);
+        return 0;
+      }
+      bhold(b);
+      bk->hits++;
+      release(&bk->lock);
       release(&bcache.lock);
       acquiresleep(&b->lock);
       return b;
     }
+
+    for(;;){
+      acquire(&bcache.lrulock);
+      b = lruvictim();
+      release(&bcache.lrulock);
+      if(b == 0)
+        break;
+
+      // Only recycling changes b's dev and blockno, so its
+      // chain is known; but someone may use b before we lock
+      // it.  Then try the next one.
+      oh = BHASH(b->dev, b->blockno);
+      old = BUCKET(oh);
+      if(old != bk)
+        bucketlock(old);
+      if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0)
+        break;
+      if(old != bk)
+        release(&old->lock);
+    }
+    if(b)
+      break;
+    if(ahead){
+      release(&bk->lock);
+      release(&bcache.lock);
+      return 0;
+    }
+
+    // All buffers are in use.  Wait for a brelse(), then
+    // start over, as someone else may have read the block.
+    release(&bk->lock);
+    release(&bcache.lock);
+    acquire(&bcache.lrulock);
+    bcache.nwait++;
+    while(lruvictim() == 0)
+      sleep(&bcache.lru, &bcache.lrulock);
+    bcache.nwait--;
+    release(&bcache.lrulock);
   }
-  panic("bget: no buffers");
+  if(ahead)
+    bk->aheads++;
+  else
+    bk->misses++;
+
+  lruunlink(b);
+  for(pp = &bcache.hash[oh]; *pp != b; pp = &(*pp)->hnext)
+    ;
+  *pp = b->hnext;
+  if(old != bk)
+    release(&old->lock);
+
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+  b->hnext = bcache.hash[h];
+  bcache.hash[h] = b;
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -98,13 +309,73 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if((b->flags & B_VALID) == 0) {
     iderw(b);
   }
   return b;
 }
 
+// Copy n bytes at off of the indicated block to dst, if the
+// block is in the cache, without waiting for it or locking it.
+// Returns -1 if it is not there or not read yet.  The caller
+// must know that nobody is changing those bytes.
+int
+bpeek(uint dev, uint blockno, void *dst, uint off, uint n)
+{
+  struct buf *b;
+  struct bucket *bk;
+  uint h;
+  int r;
+
+  h = BHASH(dev, blockno);
+  bk = BUCKET(h);
+  bucketlock(bk);
+  r = -1;
+  if((b = bfind(h, dev, blockno)) != 0 && (b->flags & B_VALID)){
+    memmove(dst, b->data + off, n);
+    r = 0;
+  }
+  release(&bk->lock);
+  return r;
+}
+
+// Start the disk on locked buffer b without waiting: write
+// it if B_DIRTY is set, else read it.  When the disk is done,
+// the interrupt handler calls done, if not 0.  done may
+// release b, but then nobody may bwait() for it.
+void
+bsubmit(struct buf *b, void (*done)(struct buf*))
+{
+  if(!holdingsleep(&b->lock))
+    panic("bsubmit");
+  idesubmit(b, done);
+}
+
+// Wait for the disk to finish with b, which was bsubmit()ted.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  idewaitrw(b);
+}
+
+static void bput(struct buf*);
+
+// Start reading the indicated block into the cache, unless it
+// is there already, without waiting for the disk.  The disk
+// interrupt releases the buffer when the read is done.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bget(dev, blockno, 1)) == 0)
+    return;
+  bsubmit(b, bput);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -116,29 +387,82 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Move to the head of the LRU list.
 void
 brelse(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("brelse");
+  bput(b);
+}
 
+// Unlock b and drop a reference to it.  Also the completion
+// of breadahead(), called from the disk interrupt on behalf of
+// whichever process started the read.
+static void
+bput(struct buf *b)
+{
   releasesleep(&b->lock);
+  bunpin(b);
+}
+
+// Keep locked buffer b in the cache after brelse(), until
+// bunpin().  Nothing else may change its contents meanwhile
+// without the pinner knowing.
+void
+bpin(struct buf *b)
+{
+  struct bucket *bk;
+
+  if(!holdingsleep(&b->lock))
+    panic("bpin");
+  bk = BUCKET(BHASH(b->dev, b->blockno));
+  bucketlock(bk);
+  bhold(b);
+  release(&bk->lock);
+}
+
+// Drop a reference to b, which caller has not locked; the
+// last one puts b back on the LRU list.
+void
+bunpin(struct buf *b)
+{
+  struct bucket *bk;
 
-  acquire(&bcache.lock);
+  bk = BUCKET(BHASH(b->dev, b->blockno));
+  bucketlock(bk);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    acquire(&bcache.lrulock);
+    b->next = bcache.lru.next;
+    b->prev = &bcache.lru;
+    bcache.lru.next->prev = b;
+    bcache.lru.next = b;
+    if(bcache.nwait > 0)
+      wakeup(&bcache.lru);
+    release(&bcache.lrulock);
   }
   
-  release(&bcache.lock);
+  release(&bk->lock);
+}
+
+// Add up the buffer cache counters of all buckets.
+void
+bstat(struct iostat *st)
+{
+  struct bucket *bk;
+
+  memset(st, 0, sizeof(*st));
+  st->nbuf = bcache.nbuf;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    acquire(&bk->lock);
+    st->bhits += bk->hits;
+    st->bmisses += bk->misses;
+    st->bwaits += bk->waits;
+    st->baheads += bk->aheads;
+    release(&bk->lock);
+  }
 }
 //PAGEBREAK!
 // Blank page.
-
@@ -6,8 +6,11 @@ struct buf {
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
+  struct buf *hnext; // hash bucket chain
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  void (*done)(struct buf*); // called when the disk is done
+  uint qtime;        // ticks when queued for the disk
+  uchar *data;      // BSIZE bytes
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
@@ -2,6 +2,8 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct pcidev;
+struct iostat;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -9,12 +11,20 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bstat(struct iostat*);
+void            breadahead(uint, uint);
+void            bsubmit(struct buf*, void (*)(struct buf*));
+void            bwait(struct buf*);
+int             bpeek(uint, uint, void*, uint, uint);
+void            bpin(struct buf*);
+void            bunpin(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -50,6 +60,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+uint            ireadahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
@@ -57,15 +68,20 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idesubmit(struct buf*, void (*)(struct buf*));
+void            idewaitrw(struct buf*);
+void            idestats(struct iostat*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
+void            ioapicroute(int irq, int vector, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+int             kfreecount(void);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -96,6 +112,13 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pci.c
+void            pciinit(void);
+struct pcidev*  pcinext(struct pcidev*);
+void            pcienable(struct pcidev*);
+uint            pciread(struct pcidev*, int);
+void            pciwrite(struct pcidev*, int, uint);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
@@ -108,6 +131,9 @@ int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+int             mmap(struct file*, uint, uint, int, int);
+int             munmap(uint, uint);
+void            unmapall(struct proc*);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
@@ -152,6 +178,7 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argwritable(char*, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -181,11 +208,14 @@ int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copyuvm(pde_t*, uint, struct vma*);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+struct vma*     findvma(struct proc*, uint);
+uint            uvmend(struct proc*, uint);
+int             mmapfault(struct proc*, uint);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -0,0 +1,81 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "iostat.h"
+
+#define SIZE 1024   // bytes per read or write, as in bigfiletest
+
+char buf[SIZE];
+
+// Print how long one phase took and what the disk driver did.
+void
+report(char *what, int mb, int ticks, struct iostat *s0, struct iostat *s1)
+{
+  printf(1, "%s: %d MB in %d ticks, %d KB/tick; "
+         "%d requests, %d interrupts, %d kcycles/MB in the driver\n",
+         what, mb, ticks, ticks ? mb * 1024 / ticks : 0,
+         s1->ioreqs - s0->ioreqs, s1->iointrs - s0->iointrs,
+         (s1->iokcycles - s0->iokcycles) / mb);
+}
+
+// Disk throughput and driver cost: bigfiletest's write and read
+// of a big file, timed and without the printing.  The file is at
+// least half as big again as the buffer cache, so the reads come
+// from the disk.  Build with IDEPIO=1 to compare PIO with DMA,
+// or with DISK=virtio to compare IDE with virtio-blk.
+// Usage: diskbench [MB]
+int
+main(int argc, char *argv[])
+{
+  char *name = "diskbench.file";
+  int fd, mb, i, n, start;
+  struct iostat s0, s1;
+
+  iostat(&s0);
+  mb = s0.nbuf / (1024*1024 / BSIZE) * 3 / 2 + 1;
+  if (mb < 16)
+    mb = 16;
+  if (argc > 1)
+    mb = atoi(argv[1]);
+  n = mb * 1024 * 1024 / SIZE;
+  printf(1, "disk: %s; file: %d MB\n", s0.iodma ? "dma" : "pio", mb);
+  memset(buf, 'a', SIZE);
+
+  start = uptime();
+  fd = open(name, O_CREATE | O_RDWR);
+  if (fd < 0) {
+    printf(1, "create failed\n");
+    exit();
+  }
+  for (i = 0; i < n; i++) {
+    if (write(fd, buf, SIZE) != SIZE) {
+      printf(1, "write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  sync();
+  iostat(&s1);
+  report("write", mb, uptime() - start, &s0, &s1);
+
+  iostat(&s0);
+  start = uptime();
+  fd = open(name, O_RDONLY);
+  for (i = 0; i < n; i++) {
+    if (read(fd, buf, SIZE) != SIZE || buf[0] != 'a') {
+      printf(1, "read failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  iostat(&s1);
+  report("read", mb, uptime() - start, &s0, &s1);
+
+  start = uptime();
+  unlink(name);
+  sync();
+  printf(1, "unlink: %d ticks\n", uptime() - start);
+  exit();
+}
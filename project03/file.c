@@ -10,6 +10,9 @@
 #include "sleeplock.h"
 #include "file.h"
 
+#define RAMIN  4  // blocks read ahead when a file is first read in order
+#define RAMAX 64  // most blocks read ahead
+
 struct devsw devsw[NDEV];
 struct {
   struct spinlock lock;
@@ -32,6 +35,7 @@ filealloc(void)
   for(f = ftable.file; f < ftable.file + NFILE; f++){
     if(f->ref == 0){
       f->ref = 1;
+      f->raoff = f->rawin = f->raend = 0;
       release(&ftable.lock);
       return f;
     }
@@ -92,11 +96,46 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// Read ahead of a sequential reader of f, which has just read
+// from off up to f->off, so that the disk works on the next
+// blocks while the reader uses these.  The window opens at RAMIN
+// blocks and doubles with each sequential read, up to RAMAX; a
+// read from anywhere else closes it.  Caller holds f->ip->lock.
+static void
+readahead(struct file *f, uint off)
+{
+  uint bn, end;
+
+  if(off == f->raoff){
+    if(f->rawin == 0)
+      f->rawin = RAMIN;
+    else if(f->rawin < RAMAX)
+      f->rawin *= 2;
+  } else {
+    f->rawin = 0;
+    f->raend = 0;
+  }
+  f->raoff = f->off;
+  if(f->rawin == 0)
+    return;
+
+  // Blocks up to raend were asked for already.  If an indirect
+  // block was not in yet, the next call picks up where this
+  // one stopped.
+  bn = f->off / BSIZE;
+  end = bn + f->rawin;
+  if(bn < f->raend)
+    bn = f->raend;
+  if(bn < end)
+    f->raend = ireadahead(f->ip, bn, end - bn);
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
 {
   int r;
+  uint off;
 
   if(f->readable == 0)
     return -1;
@@ -104,8 +143,11 @@ fileread(struct file *f, char *addr, int n)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
+    off = f->off;
+    if((r = readi(f->ip, addr, f->off, n)) > 0){
       f->off += r;
+      readahead(f, off);
+    }
     iunlock(f->ip);
     return r;
   }
@@ -130,7 +172,7 @@ filewrite(struct file *f, char *addr, int n)
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
@@ -144,10 +186,8 @@ filewrite(struct file *f, char *addr, int n)
       iunlock(f->ip);
       end_op();
 
-      if(r < 0)
-        break;
       if(r != n1)
-        panic("short filewrite");
+        break;  // error, or the file cannot grow
       i += r;
     }
     return i == n ? n : -1;
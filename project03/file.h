@@ -6,9 +6,14 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  uint raoff;   // where the next read must start to be sequential
+  uint rawin;   // read-ahead window in blocks; 0 if not sequential
+  uint raend;   // first block not yet read ahead
 };
 
 
+#define NBMAPC 4  // translations each inode remembers
+
 // in-memory copy of an inode
 struct inode {
   uint dev;           // Device number
@@ -22,7 +27,16 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+3];
+  uint flags;
+  union {
+    uint addrs[NDIRECT+3];
+    struct extent ext[NIEXTENT];
+  };
+
+  struct extent bmc[NBMAPC]; // recent bmap() translations
+  uint bmcnext;       // bmc[] entry to replace next
+  struct buf *pin;    // last indirect or extent block used, kept cached
+  uint pinlo;         // first file block pin maps, if indirect
 };
 
 // table mapping major device number to
@@ -23,6 +23,7 @@
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void bmapinval(struct inode*);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -94,6 +95,82 @@ bfree(int dev, uint b)
   brelse(bp);
 }
 
+// How many blocks from block b+bi on are free, up to n, where
+// bitmap block bp holds the bits from block b on.
+static uint
+bfreelen(struct buf *bp, uint b, uint bi, uint n)
+{
+  uint k;
+
+  for(k = 0; k < n && bi + k < BPB && b + bi + k < sb.size; k++)
+    if(bp->data[(bi+k)/8] & (1 << ((bi+k) % 8)))
+      break;
+  return k;
+}
+
+// Allocate a run of up to n contiguous zeroed blocks, for
+// extent-mapped files.  Takes the blocks from goal on if goal is
+// free, so that a file can grow its last extent; else the first
+// run of n free blocks after goal; else the first free block
+// after goal.  Returns the first block and sets *got to how
+// many there are.
+static uint
+ballocrun(uint dev, uint goal, uint n, uint *got)
+{
+  struct buf *bp;
+  uint b, bi, lo, hi, j, k, nbmap, pass;
+
+  if(goal >= sb.size)
+    goal = 0;
+  nbmap = (sb.size + BPB - 1) / BPB;
+  for(pass = 0; pass < 2; pass++){
+    // Each bitmap block from goal's on, then goal's up to goal.
+    for(j = 0; j <= nbmap; j++){
+      b = ((goal / BPB + j) % nbmap) * BPB;
+      lo = j == 0 ? goal % BPB : 0;
+      hi = j == nbmap ? goal % BPB : BPB;
+      bp = bread(dev, BBLOCK(b, sb));
+      for(bi = lo; bi < hi && b + bi < sb.size; bi++){
+        if((k = bfreelen(bp, b, bi, n)) == 0)
+          continue;
+        if(k < n && pass == 0 && b + bi != goal){
+          bi += k;  // too short; the block after it is in use
+          continue;
+        }
+        for(*got = k; k > 0; k--)
+          bp->data[(bi+k-1)/8] |= 1 << ((bi+k-1) % 8);
+        log_write(bp);
+        brelse(bp);
+        for(k = 0; k < *got; k++)
+          bzero(dev, b + bi + k);
+        return b + bi;
+      }
+      brelse(bp);
+    }
+  }
+  panic("ballocrun: out of blocks");
+}
+
+// Free blocks [b, b+n).
+static void
+bfreerun(int dev, uint b, uint n)
+{
+  struct buf *bp;
+  int bi, m;
+
+  while(n > 0){
+    bp = bread(dev, BBLOCK(b, sb));
+    for(bi = b % BPB; n > 0 && bi < BPB; bi++, b++, n--){
+      m = 1 << (bi % 8);
+      if((bp->data[bi/8] & m) == 0)
+        panic("freeing free block");
+      bp->data[bi/8] &= ~m;
+    }
+    log_write(bp);
+    brelse(bp);
+  }
+}
+
 // Inodes.
 //
 // An inode describes a single unnamed file.
@@ -180,9 +257,11 @@ iinit(int dev)
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
+ inodestart %d bmap start %d bsize %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+          sb.bmapstart, sb.bsize);
+  if(sb.bsize != BSIZE)
+    panic("iinit: file system block size is not BSIZE");
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -204,6 +283,8 @@ ialloc(uint dev, short type)
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
+      if(type == T_FILE)
+        dip->flags = I_EXTENT;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
       return iget(dev, inum);
@@ -230,6 +311,7 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
+  dip->flags = ip->flags;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
@@ -302,6 +384,7 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
+    ip->flags = dip->flags;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
     ip->valid = 1;
@@ -331,17 +414,19 @@ void
 iput(struct inode *ip)
 {
   acquiresleep(&ip->lock);
-  if(ip->valid && ip->nlink == 0){
-    acquire(&icache.lock);
-    int r = ip->ref;
-    release(&icache.lock);
-    if(r == 1){
+  acquire(&icache.lock);
+  int r = ip->ref;
+  release(&icache.lock);
+  if(r == 1){
+    if(ip->valid && ip->nlink == 0){
       // inode has no links and no other references: truncate and free.
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
       ip->valid = 0;
     }
+    // Give the pinned block back to the buffer cache.
+    bmapinval(ip);
   }
   releasesleep(&ip->lock);
 
@@ -365,11 +450,291 @@ iunlockput(struct inode *ip)
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
 // listed in block ip->addrs[NDIRECT].
+//
+// Regular files are extent-mapped instead (I_EXTENT): ip->ext[]
+// lists up to NIEXTENT runs of blocks, in file order.  When a
+// file needs more, I_XTREE is set and each ip->ext[] entry names
+// an extent block of up to NXEXTENT runs, with lbn the first
+// file block and len the number of runs in it.
+//
+// So that reads need not walk the indirect or extent blocks
+// each time, ip->bmc[] remembers the last few translations bmap()
+// made, and ip->pin keeps the last indirect or extent block it
+// went through in the buffer cache, to be read without locking
+// it: caller holds ip->lock, and only bmap() and itrunc() of ip
+// change those blocks.  Allocating or freeing blocks forgets both.
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+static void
+eset(struct extent *e, uint lbn, uint addr, uint len)
+{
+  e->lbn = lbn;
+  e->addr = addr;
+  e->len = len;
+}
+
+// Forget ip's remembered translations and unpin its block.
+static void
+bmapinval(struct inode *ip)
+{
+  if(ip->pin){
+    bunpin(ip->pin);
+    ip->pin = 0;
+  }
+  memset(ip->bmc, 0, sizeof(ip->bmc));
+  ip->bmcnext = 0;
+}
+
+// Remember that file blocks [bn, bn+n) of ip are at disk
+// blocks from addr on.
+static void
+bmapnote(struct inode *ip, uint bn, uint addr, uint n)
+{
+  eset(&ip->bmc[ip->bmcnext], bn, addr, n);
+  ip->bmcnext = (ip->bmcnext + 1) % NBMAPC;
+}
+
+// Keep locked buffer bp, an indirect block mapping file blocks
+// from lo on, or an extent block, as ip's pinned block.
+static void
+bmappin(struct inode *ip, struct buf *bp, uint lo)
+{
+  if(ip->pin == bp)
+    return;
+  if(ip->pin)
+    bunpin(ip->pin);
+  bpin(bp);
+  ip->pin = bp;
+  ip->pinlo = lo;
+}
+
+// Disk address of file block bn of ip if bmap() can tell
+// without reading anything, else 0.
+static uint
+bmapcached(struct inode *ip, uint bn)
+{
+  struct extent *c;
+
+  for(c = ip->bmc; c < ip->bmc+NBMAPC; c++)
+    if(bn - c->lbn < c->len)
+      return c->addr + (bn - c->lbn);
+  if(ip->pin && !(ip->flags & I_EXTENT) && bn - ip->pinlo < NINDIRECT)
+    return ((uint*)ip->pin->data)[bn - ip->pinlo];
+  return 0;
+}
+
+// Do file blocks from bn at disk blocks from addr continue e?
+static int
+econtinues(struct extent *e, uint bn, uint addr)
+{
+  return e->lbn + e->len == bn && e->addr + e->len == addr;
+}
+
+// Number of ip->ext[] entries in use.
+static uint
+ecount(struct inode *ip)
+{
+  uint n;
+
+  for(n = 0; n < NIEXTENT && ip->ext[n].len; n++)
+    ;
+  return n;
+}
+
+// The ip->ext[] entry for the extent block that would map file
+// block bn.  Only for I_XTREE.
+static struct extent*
+eindex(struct inode *ip, uint bn)
+{
+  int i;
+
+  for(i = ecount(ip) - 1; i > 0 && ip->ext[i].lbn > bn; i--)
+    ;
+  return &ip->ext[i];
+}
+
+// The run of the n runs e[] that has file block bn, or 0.
+static struct extent*
+erun(struct extent *e, uint n, uint bn)
+{
+  uint lo, hi, mid;
+
+  lo = 0;
+  hi = n;
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    if(bn < e[mid].lbn)
+      hi = mid;
+    else if(bn - e[mid].lbn >= e[mid].len)
+      lo = mid + 1;
+    else
+      return &e[mid];
+  }
+  return 0;
+}
+
+// Disk address of file block bn in the n runs e[], or 0.
+static uint
+efind(struct extent *e, uint n, uint bn)
+{
+  struct extent *r;
+
+  if((r = erun(e, n, bn)) == 0)
+    return 0;
+  return r->addr + (bn - r->lbn);
+}
+
+// Disk address of file block bn of extent-mapped ip, or 0 if
+// it has none yet.  Remembers the run it is in.
 static uint
-bmap(struct inode *ip, uint bn)
+elookup(struct inode *ip, uint bn)
+{
+  struct extent *x, *r;
+  struct buf *bp;
+
+  if(!(ip->flags & I_XTREE))
+    r = erun(ip->ext, ecount(ip), bn);
+  else {
+    x = eindex(ip, bn);
+    if(ip->pin && ip->pin->blockno == x->addr)
+      r = erun((struct extent*)ip->pin->data, x->len, bn);
+    else {
+      bp = bread(ip->dev, x->addr);
+      r = erun((struct extent*)bp->data, x->len, bn);
+      bmappin(ip, bp, 0);
+      brelse(bp);
+    }
+  }
+  if(r == 0)
+    return 0;
+  bmapnote(ip, r->lbn, r->addr, r->len);
+  return r->addr + (bn - r->lbn);
+}
+
+// Copy ip's last run to *e; e->len is 0 if it has none.
+static void
+elast(struct inode *ip, struct extent *e)
+{
+  struct extent *x;
+  struct buf *bp;
+  uint n;
+
+  if((n = ecount(ip)) == 0){
+    eset(e, 0, 0, 0);
+    return;
+  }
+  x = &ip->ext[n-1];
+  if(!(ip->flags & I_XTREE)){
+    *e = *x;
+    return;
+  }
+  bp = bread(ip->dev, x->addr);
+  *e = ((struct extent*)bp->data)[x->len-1];
+  brelse(bp);
+}
+
+// ip->ext[] is full: move its runs to an extent block, and make
+// ip->ext[0] name that block.
+static void
+etree(struct inode *ip)
+{
+  struct buf *bp;
+  uint addr, lbn;
+
+  addr = balloc(ip->dev);
+  bp = bread(ip->dev, addr);
+  memmove(bp->data, ip->ext, sizeof(ip->ext));
+  log_write(bp);
+  brelse(bp);
+  lbn = ip->ext[0].lbn;
+  memset(ip->ext, 0, sizeof(ip->ext));
+  eset(&ip->ext[0], lbn, addr, NIEXTENT);
+  ip->flags |= I_XTREE;
+}
+
+// File blocks [bn, bn+n), past ip's last run, are at disk blocks
+// from addr on: grow the last run if they continue it, else add
+// a run.  Returns -1 if there is no room for another run.
+static int
+eadd(struct inode *ip, uint bn, uint addr, uint n)
+{
+  struct extent *x, *e;
+  struct buf *bp;
+  uint i;
+
+  if(!(ip->flags & I_XTREE)){
+    i = ecount(ip);
+    if(i > 0 && econtinues(&ip->ext[i-1], bn, addr)){
+      ip->ext[i-1].len += n;
+      return 0;
+    }
+    if(i < NIEXTENT){
+      eset(&ip->ext[i], bn, addr, n);
+      return 0;
+    }
+    etree(ip);
+  }
+
+  x = &ip->ext[ecount(ip) - 1];
+  bp = bread(ip->dev, x->addr);
+  e = (struct extent*)bp->data;
+  if(econtinues(&e[x->len-1], bn, addr))
+    e[x->len-1].len += n;
+  else if(x->len < NXEXTENT)
+    eset(&e[x->len++], bn, addr, n);
+  else {
+    // Start another extent block.
+    brelse(bp);
+    if(x == &ip->ext[NIEXTENT-1])
+      return -1;
+    x++;
+    eset(x, bn, balloc(ip->dev), 1);
+    bp = bread(ip->dev, x->addr);
+    eset((struct extent*)bp->data, bn, addr, n);
+  }
+  log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
+// bmap() for extent-mapped ip.  A block past the last run is
+// allocated together with the rest of the n the caller is about
+// to write, right after the last run if they are free there.
+// Returns 0 if the extent tree has no room for another run.
+static uint
+ebmap(struct inode *ip, uint bn, uint n)
+{
+  struct extent last;
+  uint addr, got;
+
+  if((addr = elookup(ip, bn)) != 0)
+    return addr;
+  elast(ip, &last);
+  if(last.len && bn < last.lbn + last.len)
+    panic("ebmap: hole");
+  // Each new block is zeroed through the log.
+  if(n > MAXOPBLOCKS/2)
+    n = MAXOPBLOCKS/2;
+  bmapinval(ip);
+  addr = ballocrun(ip->dev, last.len ? last.addr + last.len : 0, n, &got);
+  if(eadd(ip, bn, addr, got) < 0){
+    bfreerun(ip->dev, addr, got);
+    return 0;
+  }
+  return addr;
+}
+
+// balloc() for bmap(), which forgets what it remembers of ip.
+static uint
+bmapalloc(struct inode *ip)
+{
+  bmapinval(ip);
+  return balloc(ip->dev);
+}
+
+// bmap() for a file mapped by indirect blocks.  The last
+// indirect block on the way stays pinned.
+static uint
+ibmap(struct inode *ip, uint bn)
 {
   uint addr, *a;
   struct buf *bp;
@@ -377,7 +742,7 @@ bmap(struct inode *ip, uint bn)
   // Direct block.
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = bmapalloc(ip);
     return addr;
   }
   bn -= NDIRECT;
@@ -386,15 +751,16 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = bmapalloc(ip);
 
     // Load direct block, allocating if necessary.
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+      a[bn] = addr = bmapalloc(ip);
       log_write(bp);
     }
+    bmappin(ip, bp, NDIRECT);
     brelse(bp);
     return addr;
   }
@@ -404,13 +770,13 @@ bmap(struct inode *ip, uint bn)
   if(bn < DINDIRECT){
     // Load first indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT+1]) == 0)
-      ip->addrs[NDIRECT+1] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT+1] = addr = bmapalloc(ip);
 
     // Load second indirect block, allocating if necessary.
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn / NINDIRECT]) == 0){
-      a[bn / NINDIRECT] = addr = balloc(ip->dev);
+      a[bn / NINDIRECT] = addr = bmapalloc(ip);
       log_write(bp);
     }
     brelse(bp);
@@ -419,9 +785,10 @@ bmap(struct inode *ip, uint bn)
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn % NINDIRECT]) == 0){
-      a[bn % NINDIRECT] = addr = balloc(ip->dev);
+      a[bn % NINDIRECT] = addr = bmapalloc(ip);
       log_write(bp);
     }
+    bmappin(ip, bp, NDIRECT + NINDIRECT + bn - bn % NINDIRECT);
     brelse(bp);
 
     return addr;
@@ -432,13 +799,13 @@ bmap(struct inode *ip, uint bn)
   if(bn < TINDIRECT){
     // Load first indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT+2]) == 0)
-      ip->addrs[NDIRECT+2] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT+2] = addr = bmapalloc(ip);
 
     // Load second indirect block, allocating if necessary.
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn / DINDIRECT]) == 0){
-      a[bn / DINDIRECT] = addr = balloc(ip->dev);
+      a[bn / DINDIRECT] = addr = bmapalloc(ip);
       log_write(bp);
     }
     brelse(bp);
@@ -447,7 +814,7 @@ bmap(struct inode *ip, uint bn)
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[(bn % DINDIRECT) / NINDIRECT]) == 0){
-      a[(bn % DINDIRECT) / NINDIRECT] = addr = balloc(ip->dev);
+      a[(bn % DINDIRECT) / NINDIRECT] = addr = bmapalloc(ip);
       log_write(bp);
     }
     brelse(bp);
@@ -456,9 +823,10 @@ bmap(struct inode *ip, uint bn)
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[(bn % DINDIRECT) % NINDIRECT]) == 0){
-      a[(bn % DINDIRECT) % NINDIRECT] = addr = balloc(ip->dev);
+      a[(bn % DINDIRECT) % NINDIRECT] = addr = bmapalloc(ip);
       log_write(bp);
     }
+    bmappin(ip, bp, NDIRECT + NINDIRECT + DINDIRECT + bn - bn % NINDIRECT);
     brelse(bp);
 
     return addr;
@@ -467,6 +835,154 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one; n is how many
+// blocks from bn on the caller is about to write, which
+// extent-mapped files allocate together.  Returns 0 if an
+// extent-mapped file is too fragmented to grow any more.
+static uint
+bmap(struct inode *ip, uint bn, uint n)
+{
+  uint addr;
+
+  if((addr = bmapcached(ip, bn)) != 0)
+    return addr;
+  if(ip->flags & I_EXTENT)
+    return ebmap(ip, bn, n);
+  return ibmap(ip, bn);
+}
+
+// elookup() without waiting for the disk: if the extent block
+// is not in the cache yet, start reading it and return 0.
+static uint
+ebmapahead(struct inode *ip, uint bn)
+{
+  struct extent *x, e;
+  uint lo, hi, mid;
+
+  if(!(ip->flags & I_XTREE))
+    return efind(ip->ext, ecount(ip), bn);
+  x = eindex(ip, bn);
+  lo = 0;
+  hi = x->len;
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    if(bpeek(ip->dev, x->addr, &e, mid*sizeof(e), sizeof(e)) < 0){
+      breadahead(ip->dev, x->addr);
+      return 0;
+    }
+    if(bn < e.lbn)
+      hi = mid;
+    else if(bn - e.lbn >= e.len)
+      lo = mid + 1;
+    else
+      return e.addr + (bn - e.lbn);
+  }
+  return 0;
+}
+
+// Return the disk address of the nth block of inode ip like
+// bmap(), but without waiting for the disk or allocating.
+// If an indirect block on the way is not in the cache yet,
+// start reading it and return 0.  Caller holds ip->lock, so
+// the indirect blocks cannot change under us.
+static uint
+bmapahead(struct inode *ip, uint bn)
+{
+  uint addr, idx[3], i, n;
+
+  if(ip->flags & I_EXTENT)
+    return ebmapahead(ip, bn);
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  bn -= NDIRECT;
+
+  if(bn < NINDIRECT){
+    addr = ip->addrs[NDIRECT];
+    idx[0] = bn;
+    n = 1;
+  } else if((bn -= NINDIRECT) < DINDIRECT){
+    addr = ip->addrs[NDIRECT+1];
+    idx[0] = bn / NINDIRECT;
+    idx[1] = bn % NINDIRECT;
+    n = 2;
+  } else if((bn -= DINDIRECT) < TINDIRECT){
+    addr = ip->addrs[NDIRECT+2];
+    idx[0] = bn / DINDIRECT;
+    idx[1] = (bn % DINDIRECT) / NINDIRECT;
+    idx[2] = (bn % DINDIRECT) % NINDIRECT;
+    n = 3;
+  } else
+    return 0;
+
+  for(i = 0; i < n && addr != 0; i++){
+    if(bpeek(ip->dev, addr, &addr, idx[i]*sizeof(uint), sizeof(uint)) < 0){
+      breadahead(ip->dev, addr);
+      return 0;
+    }
+  }
+  return addr;
+}
+
+// Start reading blocks [bn, bn+n) of ip into the buffer
+// cache, stopping at the end of the file.  Does not wait for
+// the disk.  Returns the first block it did not ask for.
+// Caller must hold ip->lock.
+uint
+ireadahead(struct inode *ip, uint bn, uint n)
+{
+  uint addr;
+
+  if(ip->type == T_DEV)
+    return bn;
+  for(; n > 0 && bn*BSIZE < ip->size; bn++, n--){
+    if((addr = bmapahead(ip, bn)) == 0)
+      break;  // Wait until the indirect block is in.
+    breadahead(ip->dev, addr);
+  }
+  return bn;
+}
+
+// Start reading all the blocks that indirect block a names,
+// which are indirect blocks too, so that the disk fetches them
+// while itrunc() works through them one by one.
+static void
+indirectahead(uint dev, uint *a)
+{
+  int i;
+
+  for(i = 0; i < NINDIRECT; i++)
+    if(a[i])
+      breadahead(dev, a[i]);
+}
+
+// Free the blocks of extent-mapped ip, and its extent blocks.
+static void
+etrunc(struct inode *ip)
+{
+  struct buf *bp;
+  struct extent *e;
+  uint i, j, n;
+
+  n = ecount(ip);
+  if(ip->flags & I_XTREE)
+    for(i = 0; i < n; i++)
+      breadahead(ip->dev, ip->ext[i].addr);
+  for(i = 0; i < n; i++){
+    if(ip->flags & I_XTREE){
+      bp = bread(ip->dev, ip->ext[i].addr);
+      e = (struct extent*)bp->data;
+      for(j = 0; j < ip->ext[i].len; j++)
+        bfreerun(ip->dev, e[j].addr, e[j].len);
+      brelse(bp);
+      bfree(ip->dev, ip->ext[i].addr);
+    } else
+      bfreerun(ip->dev, ip->ext[i].addr, ip->ext[i].len);
+  }
+  memset(ip->ext, 0, sizeof(ip->ext));
+  ip->flags &= ~I_XTREE;
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -479,6 +995,14 @@ itrunc(struct inode *ip)
   struct buf *bp, *bp2, *bp3;
   uint *a, *b, *c;
 
+  bmapinval(ip);
+  if(ip->flags & I_EXTENT){
+    etrunc(ip);
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
+
   // Truncate direct block.
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -504,6 +1028,7 @@ itrunc(struct inode *ip)
   if(ip->addrs[NDIRECT + 1]){
     bp = bread(ip->dev, ip->addrs[NDIRECT + 1]);
     a = (uint*)bp->data;
+    indirectahead(ip->dev, a);
     for(i = 0; i < NINDIRECT; i++){
       if(a[i]) {
         bp2 = bread(ip->dev, a[i]);
@@ -525,10 +1050,12 @@ itrunc(struct inode *ip)
   if(ip->addrs[NDIRECT + 2]){
     bp = bread(ip->dev, ip->addrs[NDIRECT + 2]);
     a = (uint*)bp->data;
+    indirectahead(ip->dev, a);
     for(i = 0; i < NINDIRECT; i++){
       if(a[i]) {
         bp2 = bread(ip->dev, a[i]);
         b = (uint*)bp2->data;
+        indirectahead(ip->dev, b);
         for(j = 0; j < NINDIRECT; j++){
           if(b[j]) {
             bp3 = bread(ip->dev, b[j]);
@@ -587,7 +1114,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    bp = bread(ip->dev, bmap(ip, off/BSIZE, 1));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
@@ -596,12 +1123,14 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 }
 
 // PAGEBREAK!
-// Write data to inode.
+// Write data to inode.  Returns the number of bytes
+// written, which is short if an extent-mapped file runs
+// out of room for runs.
 // Caller must hold ip->lock.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, last, addr;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -612,22 +1141,25 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(off + n > MAXFILESZ)
     return -1;
+  last = (off + n - 1) / BSIZE;  // last block written
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if((addr = bmap(ip, off/BSIZE, last - off/BSIZE + 1)) == 0)
+      break;  // Out of extents: a short write.
+    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(bp->data + off%BSIZE, src, m);
     log_write(bp);
     brelse(bp);
   }
 
-  if(n > 0 && off > ip->size){
+  if(tot > 0 && off > ip->size){
     ip->size = off;
     iupdate(ip);
   }
-  return n;
+  return tot;
 }
 
 //PAGEBREAK!
@@ -3,7 +3,14 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+
+// Block size, a multiple of the 512-byte disk sector and at most
+// a page.  mkfs records it in the super block, and the kernel
+// will only mount a file system with its own BSIZE.  Build with
+// e.g. `make clean; make BSIZE=512` for another size.
+#ifndef BSIZE
+#define BSIZE 4096
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -19,13 +26,35 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size (bytes)
 };
 
-#define NDIRECT 10
+#define NDIRECT 9
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define DINDIRECT (128 * 128)
-#define TINDIRECT (128 * 128 * 128)
+#define DINDIRECT (NINDIRECT * NINDIRECT)
+#define TINDIRECT (NINDIRECT * NINDIRECT * NINDIRECT)
 #define MAXFILE (NDIRECT + NINDIRECT + DINDIRECT + TINDIRECT)
+// MAXFILE blocks in bytes, or as many as a uint size can count.
+#define MAXFILESZ (MAXFILE > 0xffffffff / BSIZE ? 0xffffffff : MAXFILE * BSIZE)
+
+// A run of len blocks of a file, from file block lbn, at disk
+// blocks addr onwards.
+struct extent {
+  uint lbn;
+  uint addr;
+  uint len;
+};
+
+// Extents that fit in place of addrs[], and in an extent block.
+// An extent-mapped file can have NIEXTENT*NXEXTENT runs, so how
+// far below MAXFILESZ it can grow depends on how contiguous its
+// blocks are; past that, writei() writes short.
+#define NIEXTENT ((NDIRECT+3)*sizeof(uint) / sizeof(struct extent))
+#define NXEXTENT (BSIZE / sizeof(struct extent))
+
+// Inode flags.
+#define I_EXTENT 0x1  // blocks are in ext[], not addrs[]
+#define I_XTREE  0x2  // ext[] entries name extent blocks
 
 // On-disk inode structure
 struct dinode {
@@ -34,7 +63,11 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+3];   // Data block addresses
+  uint flags;           // I_EXTENT, I_XTREE
+  union {
+    uint addrs[NDIRECT+3];   // Data block addresses
+    struct extent ext[NIEXTENT]; // Data block runs, if I_EXTENT
+  };
 };
 
 // Inodes per block.
@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver code.  Uses the PIIX controller's bus-master DMA
+// when there is one, and PIO otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +13,8 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
+#include "pci.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,16 +26,61 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
+// Bus-master DMA registers of the primary channel, from bmbase.
+#define BM_CMD        0     // command
+#define BM_STATUS     2     // status
+#define BM_PRDT       4     // physical address of the PRD table
+#define BM_START      0x01  // BM_CMD: start transfer
+#define BM_READ       0x08  // BM_CMD: disk to memory
+#define BM_ERR        0x02  // BM_STATUS: transfer failed
+#define BM_INTR       0x04  // BM_STATUS: disk interrupted
+
+// Physical region descriptor: one piece of memory for a DMA
+// transfer.  The controller walks the table until PRD_EOT.
+struct prd {
+  uint addr;
+  ushort len;     // bytes; 0 means 64 KB
+  ushort flags;
+};
+#define PRD_EOT       0x8000
+
+// idequeue points to the bufs now being read/written to the disk,
+// idenrun of them, which one command transfers.  The bufs after
+// them wait in C-LOOK order: ascending from the block where the
+// current command ends, then ascending from the lowest block.
 // You must hold idelock while manipulating queue.
 
+#define NMERGE     32  // most blocks one command transfers
+#define IDEDEADLINE 50  // ticks a request may wait before going first
+
 static struct spinlock idelock;
 static struct buf *idequeue;
+static int idenrun;   // bufs in the command in progress
+static int idesect;   // sectors of it transferred so far
+static int idemult;   // sectors per interrupt, without DMA
+static int idedma;    // move data by DMA, not PIO
+static ushort bmbase; // bus-master registers, if idedma
+
+// One entry per buf in a command, so it cannot cross 64 KB.
+static struct prd prdt[NMERGE] __attribute__((aligned(sizeof(struct prd)*NMERGE)));
+
+static struct {
+  uint reqs;          // bufs done
+  uint cmds;          // disk commands issued
+  uint depth;         // sum of queue depths seen by new requests
+  uint wait;          // sum of ticks from request to done
+  uint expired;       // requests moved to the front for their deadline
+  uint intrs;         // disk interrupts
+  uint kcycles;       // 1024s of cycles spent in the driver
+  uint cycles;        // and the rest
+} idestat;
 
 static int havedisk1;
-static void idestart(struct buf*);
+static void idestart(void);
 
 // Wait for IDE disk to become ready.
 static int
@@ -47,6 +95,56 @@ idewait(int checkerr)
   return 0;
 }
 
+// Look for an IDE controller that can be a bus master, such as
+// the PIIX that QEMU emulates, and turn DMA on.
+static void
+idedmainit(void)
+{
+  struct pcidev *d;
+
+#ifdef IDEPIO
+  return;  // built to use PIO only
+#endif
+  for(d = pcinext(0); d; d = pcinext(d)){
+    // Class mass storage, subclass IDE; bit 7 of the
+    // programming interface says it can be a bus master.
+    if((d->class >> 8) != 0x0101 || !(d->class & 0x80))
+      continue;
+    if(!(d->bar[4] & PCI_BAR_IO) || (d->bar[4] & PCI_BAR_IOMASK) == 0)
+      continue;
+    bmbase = d->bar[4] & PCI_BAR_IOMASK;
+    pcienable(d);
+    outb(bmbase+BM_CMD, 0);
+    outb(bmbase+BM_STATUS, BM_INTR|BM_ERR);
+    idedma = 1;
+    cprintf("ide: bus-master dma at port 0x%x\n", bmbase);
+    return;
+  }
+}
+
+// Count the cycles since t0 as spent in the driver.
+// Caller must hold idelock.
+static void
+idecycles(uint t0)
+{
+  idestat.cycles += rdtsc() - t0;
+  idestat.kcycles += idestat.cycles >> 10;
+  idestat.cycles &= 1023;
+}
+
+// Set the sectors the drive moves per interrupt in PIO
+// transfers by READ/WRITE MULTIPLE.
+static int
+idesetmult(int drive, int n)
+{
+  idewait(0);
+  outb(0x3f6, 2);  // no interrupt for this
+  outb(0x1f2, n);
+  outb(0x1f6, 0xe0 | (drive<<4));
+  outb(0x1f7, IDE_CMD_SETMUL);
+  return idewait(1);
+}
+
 void
 ideinit(void)
 {
@@ -65,104 +163,308 @@ ideinit(void)
     }
   }
 
+  // Without DMA, take one interrupt per block, not per sector.
+  idemult = BSIZE/SECTOR_SIZE;
+  if(idemult > 1 && (idesetmult(0, idemult) < 0 ||
+                     (havedisk1 && idesetmult(1, idemult) < 0)))
+    idemult = 1;
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  idedmainit();
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Where the head will be when the command in progress is done.
+// Caller must hold idelock.
+static uint
+idepos(void)
+{
+  struct buf *b;
+  int i;
+
+  b = idequeue;
+  for(i = 1; i < idenrun; i++)
+    b = b->qnext;
+  return b ? b->blockno : 0;
+}
+
+// Put b into the waiting part of the queue, in C-LOOK order from
+// block pos.  Caller must hold idelock.
+static void
+ideinsert(struct buf *b, uint pos)
+{
+  struct buf **pp;
+  int i;
+
+  pp = &idequeue;
+  for(i = 0; i < idenrun && *pp; i++)
+    pp = &(*pp)->qnext;
+  // Blocks below pos wrap around to the end.
+  for(; *pp; pp = &(*pp)->qnext)
+    if((*pp)->blockno - pos > b->blockno - pos)
+      break;
+  b->qnext = *pp;
+  *pp = b;
+}
+
+// Choose the next command: the first waiting buf, or one that
+// has waited longer than IDEDEADLINE, and whichever bufs after it
+// continue it on the disk.  Then start the disk on it.
+// Caller must hold idelock, and no command may be in progress.
 static void
-idestart(struct buf *b)
+idestart(void)
 {
-  if(b == 0)
-    panic("idestart");
-  if(b->blockno >= FSSIZE)
+  struct buf *b, *old, **pp, *q;
+  int i, n, sector_per_block, sector;
+
+  if(idequeue == 0)
+    return;
+
+  // Bound the time a request far from the head may wait.
+  old = idequeue;
+  for(b = idequeue; b; b = b->qnext)
+    if((int)(b->qtime - old->qtime) < 0)
+      old = b;
+  if(old != idequeue && ticks - old->qtime > IDEDEADLINE){
+    idestat.expired++;
+    for(pp = &idequeue; *pp != old; pp = &(*pp)->qnext)
+      ;
+    *pp = old->qnext;
+    q = idequeue;
+    idequeue = old;
+    old->qnext = 0;
+    idenrun = 1;
+    // The head starts from old's block now; sort the rest again.
+    while(q){
+      b = q;
+      q = q->qnext;
+      ideinsert(b, old->blockno);
+    }
+  }
+
+  // Merge the bufs for the blocks that follow.
+  b = idequeue;
+  for(n = 1; n < NMERGE && b->qnext; n++, b = b->qnext){
+    q = b->qnext;
+    if(q->dev != b->dev || q->blockno != b->blockno + 1 ||
+       (q->flags & B_DIRTY) != (b->flags & B_DIRTY))
+      break;
+  }
+  idenrun = n;
+  idesect = 0;
+  idestat.cmds++;
+
+  b = idequeue;
+  if(b->blockno + n > FSSIZE)
     panic("incorrect blockno");
-  int sector_per_block =  BSIZE/SECTOR_SIZE;
-  int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  sector_per_block =  BSIZE/SECTOR_SIZE;
+  sector = b->blockno * sector_per_block;
+  if (n * sector_per_block > 256) panic("idestart");
 
-  if (sector_per_block > 7) panic("idestart");
+  if(idedma){
+    for(i = 0, q = b; i < n; i++, q = q->qnext){
+      prdt[i].addr = V2P(q->data);
+      prdt[i].len = BSIZE;
+      prdt[i].flags = 0;
+    }
+    prdt[n-1].flags = PRD_EOT;
+    outl(bmbase+BM_PRDT, V2P(prdt));
+    outb(bmbase+BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_READ);
+    outb(bmbase+BM_STATUS, BM_INTR|BM_ERR);
+  }
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, n * sector_per_block);  // number of sectors; 0 means 256
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
+  if(idedma){
+    // The disk interrupts once, when the whole command is done.
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(bmbase+BM_CMD, inb(bmbase+BM_CMD) | BM_START);
+    return;
+  }
+  // The disk interrupts once for each idemult sectors.
   if(b->flags & B_DIRTY){
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    outb(0x1f7, idemult > 1 ? IDE_CMD_WRMUL : IDE_CMD_WRITE);
+    outsl(0x1f0, b->data, idemult*SECTOR_SIZE/4);
   } else {
-    outb(0x1f7, read_cmd);
+    outb(0x1f7, idemult > 1 ? IDE_CMD_RDMUL : IDE_CMD_READ);
   }
 }
 
-// Interrupt handler.
+// The first buf in the queue is done: take it off and wake
+// whoever waits for it.  Caller must hold idelock.
+static struct buf*
+idefinish(void (**done)(struct buf*))
+{
+  struct buf *b;
+
+  b = idequeue;
+  idequeue = b->qnext;
+  idenrun--;
+  idestat.reqs++;
+  idestat.wait += ticks - b->qtime;
+  b->flags |= B_VALID;
+  b->flags &= ~B_DIRTY;
+  wakeup(b);
+  *done = b->done;
+  b->done = 0;
+  return b;
+}
+
+// Interrupt handler: the DMA command in progress is done, or
+// with PIO, idemult more sectors of it have been read or written.
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *fin[NMERGE];
+  void (*done[NMERGE])(struct buf*);
+  int i, n;
+  uint off, st, t0;
 
+  t0 = rdtsc();
   // First queued buffer is the active request.
   acquire(&idelock);
+  idestat.intrs++;
 
-  if((b = idequeue) == 0){
+  if((b = idequeue) == 0 || idenrun == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  n = 0;
+  if(idedma){
+    st = inb(bmbase+BM_STATUS);
+    if(!(st & BM_INTR)){
+      release(&idelock);
+      return;
+    }
+    outb(bmbase+BM_CMD, 0);
+    outb(bmbase+BM_STATUS, BM_INTR|BM_ERR);
+    if((st & BM_ERR) || idewait(1) < 0){
+      // Do this command, and all after it, by PIO.
+      cprintf("ide: dma failed on block %d; using pio\n", b->blockno);
+      idedma = 0;
+      idestart();
+      goto out;
+    }
+    while(idenrun > 0){
+      fin[n] = idefinish(&done[n]);
+      n++;
+    }
+  } else {
+    // Read data if needed.
+    off = (idesect % (BSIZE/SECTOR_SIZE)) * SECTOR_SIZE;
+    if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+      insl(0x1f0, b->data + off, idemult*SECTOR_SIZE/4);
+    idesect += idemult;
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    if(off + idemult*SECTOR_SIZE == BSIZE){
+      fin[n] = idefinish(&done[n]);
+      n++;
+      b = idequeue;
+    }
+
+    // Give a write its next sector.
+    if(idenrun > 0 && (b->flags & B_DIRTY)){
+      off = (idesect % (BSIZE/SECTOR_SIZE)) * SECTOR_SIZE;
+      idewait(0);
+      outsl(0x1f0, b->data + off, idemult*SECTOR_SIZE/4);
+    }
+  }
 
   // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  if(idenrun == 0)
+    idestart();
 
+out:
+  idecycles(t0);
   release(&idelock);
+
+  for(i = 0; i < n; i++)
+    if(done[i])
+      done[i](fin[i]);
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
+// Queue buf for the disk and return without waiting.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// When the request is done, ideintr() wakes up idewaitrw() and
+// then calls done, if not 0, which may release buf.
 void
-iderw(struct buf *b)
+idesubmit(struct buf *b, void (*done)(struct buf*))
 {
-  struct buf **pp;
+  struct buf *q;
+  int n;
+  uint t0;
 
   if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
+    panic("idesubmit: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
+    panic("idesubmit: nothing to do");
   if(b->dev != 0 && !havedisk1)
-    panic("iderw: ide disk 1 not present");
+    panic("idesubmit: ide disk 1 not present");
 
+  t0 = rdtsc();
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  b->done = done;
+  b->qtime = ticks;
+  n = 1;
+  for(q = idequeue; q; q = q->qnext)
+    n++;
+  idestat.depth += n;
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(idequeue == 0){
+    b->qnext = 0;
+    idequeue = b;
+    idestart();
+  } else
+    ideinsert(b, idepos());  //DOC:insert-queue
 
-  // Wait for request to finish.
+  idecycles(t0);
+  release(&idelock);
+}
+
+// Wait for the request for buf to finish.
+void
+idewaitrw(struct buf *b)
+{
+  acquire(&idelock);
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
+  release(&idelock);
+}
 
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  idesubmit(b, 0);
+  idewaitrw(b);
+}
 
+// Copy the disk queue counters to st.
+void
+idestats(struct iostat *st)
+{
+  acquire(&idelock);
+  st->ioreqs = idestat.reqs;
+  st->iocmds = idestat.cmds;
+  st->iodepth = idestat.depth;
+  st->iowait = idestat.wait;
+  st->ioexpired = idestat.expired;
+  st->iodma = idedma;
+  st->iointrs = idestat.intrs;
+  st->iokcycles = idestat.kcycles;
   release(&idelock);
 }
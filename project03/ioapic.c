@@ -66,10 +66,17 @@ ioapicinit(void)
 
 void
 ioapicenable(int irq, int cpunum)
+{
+  ioapicroute(irq, T_IRQ0 + irq, cpunum);
+}
+
+// Deliver irq as interrupt vector to cpunum.
+void
+ioapicroute(int irq, int vector, int cpunum)
 {
   // Mark interrupt edge-triggered, active high,
   // enabled, and routed to the given cpunum,
   // which happens to be that cpu's APIC ID.
-  ioapicwrite(REG_TABLE+2*irq, T_IRQ0 + irq);
+  ioapicwrite(REG_TABLE+2*irq, vector);
   ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
 }
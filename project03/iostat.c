@@ -0,0 +1,39 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "iostat.h"
+
+// Print x/y with two decimals.
+void
+ratio(char *what, uint x, uint y)
+{
+  uint r;
+
+  r = y ? x * 100 / y : 0;
+  printf(1, "%s: %d.%d%d\n", what, r / 100, r / 10 % 10, r % 10);
+}
+
+// Print the buffer cache and disk queue counters, and the
+// averages they give.
+int
+main(int argc, char *argv[])
+{
+  struct iostat st;
+
+  if (iostat(&st) < 0) {
+    printf(2, "iostat failed\n");
+    exit();
+  }
+  printf(1, "buffer cache: %d buffers, %d hits, %d misses, "
+         "%d read ahead, %d lock waits\n",
+         st.nbuf, st.bhits, st.bmisses, st.baheads, st.bwaits);
+  printf(1, "disk: %s; %d requests in %d commands, %d past deadline\n",
+         st.iodma ? "dma" : "pio", st.ioreqs, st.iocmds, st.ioexpired);
+  printf(1, "disk driver: %d interrupts, %d kcycles\n",
+         st.iointrs, st.iokcycles);
+  ratio("average queue depth", st.iodepth, st.ioreqs);
+  ratio("average service time (ticks)", st.iowait, st.ioreqs);
+  ratio("average requests per command", st.ioreqs, st.iocmds);
+  ratio("average interrupts per request", st.iointrs, st.ioreqs);
+  exit();
+}
@@ -0,0 +1,16 @@
+// Disk I/O counters, as returned by iostat().
+struct iostat {
+  uint nbuf;      // Buffers in the buffer cache
+  uint bhits;     // Buffer cache lookups that found the block
+  uint bmisses;   // and those that had to recycle a buffer
+  uint baheads;   // Blocks read ahead of the reader
+  uint bwaits;    // Times a buffer cache lock was found held
+  uint ioreqs;    // Disk requests done
+  uint iocmds;    // Disk commands, each for adjacent requests
+  uint iodepth;   // Sum of queue depths seen by new requests
+  uint iowait;    // Sum of ticks from request to done
+  uint ioexpired; // Requests served first for their deadline
+  uint iodma;     // 1 if the disk moves data by DMA, 0 if by PIO
+  uint iointrs;   // Disk interrupts
+  uint iokcycles; // Thousands (1024s) of cycles in the disk driver
+};
@@ -27,7 +27,8 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous: all blocks of a commit are sent
+// to the disk together, and the commit waits for all of them.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -64,19 +65,29 @@ initlog(int dev)
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// All the writes are started before waiting for any.
 static void
 install_trans(void)
 {
   int tail;
+  struct buf *dbuf[LOGSIZE];
+
+  // After a crash the log blocks are not cached; ask for all.
+  for (tail = 0; tail < log.lh.n; tail++)
+    breadahead(log.dev, log.start+tail+1);
 
   for (tail = 0; tail < log.lh.n; tail++) {
     struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
+    dbuf[tail] = bread(log.dev, log.lh.block[tail]); // read dst
+    memmove(dbuf[tail]->data, lbuf->data, BSIZE);  // copy block to dst
+    dbuf[tail]->flags |= B_DIRTY;
+    bsubmit(dbuf[tail], 0);  // write dst to disk
     brelse(lbuf);
-    brelse(dbuf);
+  }
+  for (tail = 0; tail < log.lh.n; tail++) {
+    bwait(dbuf[tail]);
+    brelse(dbuf[tail]);
   }
 }
 
@@ -159,18 +170,27 @@ end_op(void)
 }
 
 // Copy modified blocks from cache to log.
+// All the writes are started before waiting for any.
 static void
 write_log(void)
 {
   int tail;
+  struct buf *to[LOGSIZE];
+
+  for (tail = 0; tail < log.lh.n; tail++)
+    breadahead(log.dev, log.start+tail+1);
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
+    to[tail] = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    memmove(to[tail]->data, from->data, BSIZE);
+    to[tail]->flags |= B_DIRTY;
+    bsubmit(to[tail], 0);  // write the log
     brelse(from);
-    brelse(to);
+  }
+  for (tail = 0; tail < log.lh.n; tail++) {
+    bwait(to[tail]);
+    brelse(to[tail]);
   }
 }
 
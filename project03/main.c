@@ -28,11 +28,12 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
-  binit();         // buffer cache
   fileinit();      // file table
+  pciinit();       // pci devices
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  binit();         // buffer cache, sized from free memory
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
@@ -32,22 +32,22 @@ ideintr(void)
   // no-op
 }
 
-// Sync buf with disk.
+// Do the request for buf at once, then call done, if not 0.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
 void
-iderw(struct buf *b)
+idesubmit(struct buf *b, void (*done)(struct buf*))
 {
   uchar *p;
 
   if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
+    panic("idesubmit: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
+    panic("idesubmit: nothing to do");
   if(b->dev != 1)
-    panic("iderw: request not for disk 1");
+    panic("idesubmit: request not for disk 1");
   if(b->blockno >= disksize)
-    panic("iderw: block out of range");
+    panic("idesubmit: block out of range");
 
   p = memdisk + b->blockno*BSIZE;
 
@@ -57,4 +57,25 @@ iderw(struct buf *b)
   } else
     memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
+  if(done)
+    done(b);
+}
+
+// Requests are done when idesubmit() returns.
+void
+idewaitrw(struct buf *b)
+{
+}
+
+// No queue to count.
+void
+idestats(struct iostat *st)
+{
+}
+
+// Sync buf with disk.
+void
+iderw(struct buf *b)
+{
+  idesubmit(b, 0);
 }
@@ -0,0 +1,96 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "iostat.h"
+
+#define NFILE 100   // the file system has only 200 inodes
+#define FSIZE 1024  // bytes in each file
+
+char buf[FSIZE];
+
+static void
+fname(char *name, int i)
+{
+  name[0] = 'm';
+  name[1] = 'b';
+  name[2] = '/';
+  name[3] = '0' + i / 100;
+  name[4] = '0' + i / 10 % 10;
+  name[5] = '0' + i % 10;
+  name[6] = 0;
+}
+
+// Print how long one phase took and how many disk requests
+// and commands it made.
+static void
+report(char *what, int start, struct iostat *s0)
+{
+  struct iostat s1;
+
+  sync();
+  iostat(&s1);
+  printf(1, "%s: %d ticks, %d disk requests in %d commands\n",
+         what, uptime() - start, s1.ioreqs - s0->ioreqs,
+         s1.iocmds - s0->iocmds);
+}
+
+// Metadata-heavy workload: create, read, and delete many small
+// files in one directory, each phase synced to disk.  Compare
+// builds with different BSIZE; readbench and diskbench do the
+// sequential side.
+int
+main(int argc, char *argv[])
+{
+  char name[8];
+  int fd, i, start;
+  struct iostat s0;
+
+  printf(1, "block size %d\n", BSIZE);
+  if (mkdir("mb") < 0) {
+    printf(1, "mkdir mb failed\n");
+    exit();
+  }
+  memset(buf, 'm', FSIZE);
+
+  iostat(&s0);
+  start = uptime();
+  for (i = 0; i < NFILE; i++) {
+    fname(name, i);
+    fd = open(name, O_CREATE | O_RDWR);
+    if (fd < 0 || write(fd, buf, FSIZE) != FSIZE) {
+      printf(1, "create %s failed\n", name);
+      exit();
+    }
+    close(fd);
+  }
+  report("create", start, &s0);
+
+  iostat(&s0);
+  start = uptime();
+  for (i = 0; i < NFILE; i++) {
+    fname(name, i);
+    fd = open(name, O_RDONLY);
+    if (fd < 0 || read(fd, buf, FSIZE) != FSIZE || buf[0] != 'm') {
+      printf(1, "read %s failed\n", name);
+      exit();
+    }
+    close(fd);
+  }
+  report("read", start, &s0);
+
+  iostat(&s0);
+  start = uptime();
+  for (i = 0; i < NFILE; i++) {
+    fname(name, i);
+    if (unlink(name) < 0) {
+      printf(1, "unlink %s failed\n", name);
+      exit();
+    }
+  }
+  report("unlink", start, &s0);
+
+  unlink("mb");
+  exit();
+}
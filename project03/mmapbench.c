@@ -0,0 +1,110 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "mman.h"
+
+// The 100000-block file system has no room for 50 MB.
+#define FILESIZE (32*1024*1024)
+#define BUFSIZE 4096
+
+char buf[BUFSIZE];
+
+void
+makefile(char *filename)
+{
+  int fd, i;
+  struct stat st;
+
+  if (stat(filename, &st) == 0 && st.size == FILESIZE)
+    return;
+
+  printf(1, "Creating %s\n", filename);
+  fd = open(filename, O_CREATE | O_RDWR);
+  if (fd < 0) {
+    printf(1, "Create Failed\n");
+    exit();
+  }
+  for (i = 0; i < BUFSIZE; i++)
+    buf[i] = i;
+  for (i = 0; i < FILESIZE / BUFSIZE; i++) {
+    if (write(fd, buf, BUFSIZE) != BUFSIZE) {
+      printf(1, "Write Failed\n");
+      exit();
+    }
+  }
+  sync();
+  close(fd);
+}
+
+// Sum every byte of the file with read().
+uint
+readscan(char *filename)
+{
+  int fd, i, n;
+  uint sum;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    printf(1, "Open Failed\n");
+    exit();
+  }
+  sum = 0;
+  while ((n = read(fd, buf, BUFSIZE)) > 0)
+    for (i = 0; i < n; i++)
+      sum += (uchar)buf[i];
+  close(fd);
+  return sum;
+}
+
+// Sum every byte of the file through a private mapping.
+uint
+mmapscan(char *filename)
+{
+  int fd, i;
+  uint sum;
+  uchar *p;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    printf(1, "Open Failed\n");
+    exit();
+  }
+  p = mmap(0, FILESIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == (uchar*)-1) {
+    printf(1, "Mmap Failed\n");
+    exit();
+  }
+  close(fd);
+  sum = 0;
+  for (i = 0; i < FILESIZE; i++)
+    sum += p[i];
+  munmap(p, FILESIZE);
+  return sum;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *filename = "mmapbench.dat";
+  int start, readticks, mmapticks;
+  uint readsum, mmapsum;
+
+  makefile(filename);
+
+  start = uptime();
+  readsum = readscan(filename);
+  readticks = uptime() - start;
+
+  start = uptime();
+  mmapsum = mmapscan(filename);
+  mmapticks = uptime() - start;
+
+  if (readsum != mmapsum) {
+    printf(1, "Scan Failed: sums differ\n");
+    exit();
+  }
+  printf(1, "read: %d KB in %d ticks\n", FILESIZE / 1024, readticks);
+  printf(1, "mmap: %d KB in %d ticks\n", FILESIZE / 1024, mmapticks);
+  exit();
+}
@@ -2,6 +2,7 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
+#define NVMA         16  // mmap() regions per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
@@ -9,6 +10,8 @@
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*10)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*10)  // size of disk block cache
-#define FSSIZE       100000  // size of file system in blocks
+#define NBUF         (LOGSIZE*3)  // minimum size of disk block cache
+#define BCACHEFRAC   16  // disk block cache gets 1/BCACHEFRAC of free memory
+#define FSSIZE       (160000*512/BSIZE)  // size of file system in blocks
+#define MAXPATH      512  // longest symbolic link target, with its 0
 
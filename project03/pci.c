@@ -0,0 +1,107 @@
+// PCI configuration space, through configuration mechanism #1,
+// and a table of the devices found on it at boot.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define PCI_ADDR      0xcf8
+#define PCI_DATA      0xcfc
+
+#define PCI_ID        0x00  // vendor, device
+#define PCI_CMD       0x04  // command, status
+#define PCI_CLASS     0x08  // revision, class code
+#define PCI_HDR       0x0c  // header type in bits 16-23
+#define PCI_BAR0      0x10
+#define PCI_INTR      0x3c  // interrupt line in bits 0-7
+
+#define PCI_CMD_IO     0x1  // respond to I/O space accesses
+#define PCI_CMD_MEM    0x2  // respond to memory space accesses
+#define PCI_CMD_MASTER 0x4  // may be a bus master
+
+#define NPCIDEV 32
+
+static struct pcidev pcidevs[NPCIDEV];
+static int npcidev;
+
+static uint
+confaddr(int bus, int dev, int func, int reg)
+{
+  return 0x80000000 | (bus<<16) | (dev<<11) | (func<<8) | (reg & 0xfc);
+}
+
+static uint
+confread(int bus, int dev, int func, int reg)
+{
+  outl(PCI_ADDR, confaddr(bus, dev, func, reg));
+  return inl(PCI_DATA);
+}
+
+// Read configuration register reg of d.
+uint
+pciread(struct pcidev *d, int reg)
+{
+  return confread(d->bus, d->dev, d->func, reg);
+}
+
+// Write configuration register reg of d.
+void
+pciwrite(struct pcidev *d, int reg, uint v)
+{
+  outl(PCI_ADDR, confaddr(d->bus, d->dev, d->func, reg));
+  outl(PCI_DATA, v);
+}
+
+// Find the devices.  QEMU puts them all on bus 0, so this
+// does not look behind bridges.
+void
+pciinit(void)
+{
+  struct pcidev *d;
+  int dev, func, i;
+  uint id;
+
+  for(dev = 0; dev < 32; dev++){
+    for(func = 0; func < 8; func++){
+      id = confread(0, dev, func, PCI_ID);
+      if((id & 0xffff) == 0xffff){
+        if(func == 0)
+          break;
+        continue;
+      }
+      if(npcidev == NPCIDEV)
+        panic("pciinit: too many devices");
+      d = &pcidevs[npcidev++];
+      d->bus = 0;
+      d->dev = dev;
+      d->func = func;
+      d->vendor = id & 0xffff;
+      d->device = id >> 16;
+      d->class = pciread(d, PCI_CLASS) >> 8;
+      d->irq = pciread(d, PCI_INTR) & 0xff;
+      for(i = 0; i < 6; i++)
+        d->bar[i] = pciread(d, PCI_BAR0 + 4*i);
+      // Only multi-function devices have functions past 0.
+      if(func == 0 && !(pciread(d, PCI_HDR) & 0x800000))
+        break;
+    }
+  }
+}
+
+// The device after d, or the first one if d is 0;
+// 0 after the last.
+struct pcidev*
+pcinext(struct pcidev *d)
+{
+  d = d ? d + 1 : pcidevs;
+  return d < pcidevs + npcidev ? d : 0;
+}
+
+// Let d answer to its address ranges and be a bus master.
+void
+pcienable(struct pcidev *d)
+{
+  pciwrite(d, PCI_CMD, pciread(d, PCI_CMD) |
+           PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER);
+}
@@ -0,0 +1,14 @@
+// A function of a device on the PCI bus.
+struct pcidev {
+  uchar bus;
+  uchar dev;
+  uchar func;
+  uchar irq;        // interrupt line the BIOS assigned
+  ushort vendor;
+  ushort device;
+  uint class;       // class, subclass, programming interface
+  uint bar[6];      // base address registers, as read
+};
+
+#define PCI_BAR_IO    0x1   // bar is in I/O space
+#define PCI_BAR_IOMASK 0xfffc
@@ -6,6 +6,10 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
 
 struct {
   struct spinlock lock;
@@ -163,6 +167,8 @@ growproc(int n)
 
   sz = curproc->sz;
   if(n > 0){
+    if(sz + n > MMAPBASE)
+      return -1;
     if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   } else if(n < 0){
@@ -174,6 +180,121 @@ growproc(int n)
   return 0;
 }
 
+// Map len bytes of file f, starting at page-aligned offset off,
+// into the current process at an address between MMAPBASE and
+// KERNBASE of the kernel's choosing.  Pages are read from the
+// file on first touch (see mmapfault in vm.c).  The mapping is
+// private: writes, if prot allows them, never reach the file.
+// Returns the address, or -1.
+int
+mmap(struct file *f, uint off, uint len, int prot, int flags)
+{
+  uint start, end;
+  struct vma *v, *w;
+  struct proc *curproc = myproc();
+
+  if(f->type != FD_INODE || !f->readable)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE|MAP_ANONYMOUS)) != MAP_PRIVATE)
+    return -1;
+  if(off % PGSIZE || len == 0 || len > KERNBASE - MMAPBASE)
+    return -1;
+  len = PGROUNDUP(len);
+
+  v = 0;
+  for(w = curproc->vma; w < &curproc->vma[NVMA]; w++)
+    if(w->end == 0){
+      v = w;
+      break;
+    }
+  if(v == 0)
+    return -1;
+
+  // Take the lowest gap that fits.
+  start = MMAPBASE;
+  for(;;){
+    end = start + len;
+    if(end > KERNBASE || end < start)
+      return -1;
+    for(w = curproc->vma; w < &curproc->vma[NVMA]; w++)
+      if(w->end && w->start < end && start < w->end)
+        break;
+    if(w == &curproc->vma[NVMA])
+      break;
+    start = w->end;
+  }
+  v->start = start;
+  v->end = end;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = filedup(f);
+  v->off = off;
+  return start;
+}
+
+// Remove [addr, addr+len) from the mmap() regions of the
+// current process and free its pages.
+int
+munmap(uint addr, uint len)
+{
+  uint end;
+  struct vma *v, *w;
+  struct proc *curproc = myproc();
+
+  // Check addr first: KERNBASE - addr wraps for kernel addresses.
+  if(addr % PGSIZE || addr < MMAPBASE || addr >= KERNBASE ||
+     len == 0 || len > KERNBASE - addr)
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  for(v = curproc->vma; v < &curproc->vma[NVMA]; v++){
+    if(v->end == 0 || v->end <= addr || end <= v->start)
+      continue;
+    if(v->start < addr && end < v->end){
+      // Punching a hole in a region takes a second entry.
+      for(w = curproc->vma; w < &curproc->vma[NVMA]; w++)
+        if(w->end == 0)
+          break;
+      if(w == &curproc->vma[NVMA])
+        return -1;
+      *w = *v;
+      w->start = end;
+      w->off += end - v->start;
+      filedup(w->f);
+      v->end = addr;
+      break;
+    }
+    if(addr <= v->start && v->end <= end){
+      fileclose(v->f);
+      v->f = 0;
+      v->end = 0;
+    } else if(addr <= v->start){
+      v->off += end - v->start;
+      v->start = end;
+    } else
+      v->end = addr;
+  }
+
+  deallocuvm(curproc->pgdir, end, addr);
+  return 0;
+}
+
+// Drop every mmap() region of p.  The caller frees the pages,
+// normally along with the whole page table.
+void
+unmapall(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->end){
+      fileclose(v->f);
+      v->f = 0;
+      v->end = 0;
+    }
+  }
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
@@ -190,7 +311,7 @@ fork(void)
   }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz, curproc->vma)) == 0){
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
@@ -207,6 +328,11 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  for(i = 0; i < NVMA; i++){
+    np->vma[i] = curproc->vma[i];
+    if(np->vma[i].end)
+      filedup(np->vma[i].f);
+  }
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -241,6 +367,8 @@ exit(void)
       curproc->ofile[fd] = 0;
     }
   }
+  // The pages go with the page table in wait().
+  unmapall(curproc);
 
   begin_op();
   iput(curproc->cwd);
@@ -34,6 +34,16 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// File region mapped by mmap().  Unused if end is 0.
+struct vma {
+  uint start;                  // First address, page-aligned
+  uint end;                    // One past the last address
+  int prot;                    // PROT_ bits from mman.h
+  int flags;                   // MAP_ bits from mman.h
+  struct file *f;              // File the pages are read from
+  uint off;                    // Offset in f of start
+};
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
@@ -49,6 +59,7 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  struct vma vma[NVMA];        // mmap() regions
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -56,3 +67,5 @@ struct proc {
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
+//   ...
+//   mmap() regions, from MMAPBASE up to KERNBASE
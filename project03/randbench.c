@@ -0,0 +1,82 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "mman.h"
+#include "fs.h"
+#include "iostat.h"
+
+#define NREAD 2000  // random block reads per pass
+#define NPASS 3
+
+char buf[BSIZE];
+uint seed;
+uint sum;
+
+uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+// Random block reads across a file: each touch of a page of a
+// fresh private mapping reads one block through bmap().  Every
+// pass reads the same blocks, so later ones find more of them in
+// the buffer cache.  With the per-inode translation cache and
+// pinned block, each read should need about one buffer lookup,
+// for the data block only.
+// Usage: randbench [MB]
+int
+main(int argc, char *argv[])
+{
+  char *name = "randbench.file";
+  int fd, mb, i, n, pass, start, ticks;
+  uint lookups;
+  uchar *p;
+  struct iostat s0, s1;
+
+  mb = argc > 1 ? atoi(argv[1]) : 60;
+  n = mb * 1024 * 1024 / BSIZE;
+
+  fd = open(name, O_CREATE | O_RDWR);
+  if (fd < 0) {
+    printf(1, "create failed\n");
+    exit();
+  }
+  for (i = 0; i < n; i++) {
+    if (write(fd, buf, BSIZE) != BSIZE) {
+      printf(1, "write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  sync();
+  printf(1, "file: %d MB, %d blocks\n", mb, n);
+
+  for (pass = 0; pass < NPASS; pass++) {
+    fd = open(name, O_RDONLY);
+    p = mmap(0, n * BSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == (uchar*)-1) {
+      printf(1, "mmap failed\n");
+      exit();
+    }
+    close(fd);
+    seed = 1;
+    iostat(&s0);
+    start = uptime();
+    for (i = 0; i < NREAD; i++)
+      sum += p[rand() % n * BSIZE];
+    ticks = uptime() - start;
+    iostat(&s1);
+    munmap(p, n * BSIZE);
+    lookups = (s1.bhits - s0.bhits) + (s1.bmisses - s0.bmisses);
+    printf(1, "pass %d: %d reads in %d ticks; %d hits, %d misses\n",
+           pass, NREAD, ticks, s1.bhits - s0.bhits, s1.bmisses - s0.bmisses);
+    printf(1, "buffer lookups per read: %d.%d%d\n", lookups / NREAD,
+           lookups * 10 / NREAD % 10, lookups * 100 / NREAD % 10);
+  }
+
+  unlink(name);
+  exit();
+}
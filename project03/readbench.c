@@ -0,0 +1,67 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "iostat.h"
+
+#define BUFSIZE 4096
+#define NPASS 2
+
+char buf[BUFSIZE];
+
+// Sequential read throughput of a file bigger than the buffer
+// cache, so that every pass has to come from the disk.  Read-ahead
+// should keep the disk busy while the reader copies out the
+// blocks it has, and most blocks should show up as read ahead
+// rather than as misses.
+// Usage: readbench [MB]
+int
+main(int argc, char *argv[])
+{
+  char *name = "readbench.file";
+  int fd, mb, i, n, pass, start, ticks;
+  struct iostat s0, s1;
+
+  iostat(&s0);
+  // Half as big again as the cache, to defeat it.
+  mb = argc > 1 ? atoi(argv[1]) : s0.nbuf / (1024*1024 / BSIZE) * 3 / 2 + 1;
+  n = mb * 1024 * 1024 / BUFSIZE;
+  printf(1, "buffer cache: %d KB; file: %d MB\n", s0.nbuf * (BSIZE / 512) / 2, mb);
+
+  fd = open(name, O_CREATE | O_RDWR);
+  if (fd < 0) {
+    printf(1, "create failed\n");
+    exit();
+  }
+  for (i = 0; i < n; i++) {
+    if (write(fd, buf, BUFSIZE) != BUFSIZE) {
+      printf(1, "write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  sync();
+
+  for (pass = 0; pass < NPASS; pass++) {
+    iostat(&s0);
+    start = uptime();
+    fd = open(name, O_RDONLY);
+    for (i = 0; i < n; i++) {
+      if (read(fd, buf, BUFSIZE) != BUFSIZE) {
+        printf(1, "read failed\n");
+        exit();
+      }
+    }
+    close(fd);
+    ticks = uptime() - start;
+    iostat(&s1);
+    printf(1, "pass %d: %d MB in %d ticks; "
+           "%d blocks read ahead, %d misses, %d hits\n",
+           pass, mb, ticks, s1.baheads - s0.baheads,
+           s1.bmisses - s0.bmisses, s1.bhits - s0.bhits);
+  }
+
+  unlink(name);
+  exit();
+}
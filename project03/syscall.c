@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
+#include "mman.h"
 
 // User code makes a system call with INT T_SYSCALL.
 // System call number in %eax.
@@ -13,13 +14,32 @@
 // library system call function. The saved user %esp points
 // to a saved program counter, and then the first argument.
 
+// Fill the mmap() pages of [addr, addr+n) that nobody touched
+// yet, so the kernel can use them directly.
+static int
+fetchpages(uint addr, uint n)
+{
+  struct proc *curproc = myproc();
+  uint a;
+
+  if(addr < curproc->sz)
+    return 0;
+  for(a = PGROUNDDOWN(addr); a < addr + n; a += PGSIZE)
+    if(mmapfault(curproc, a) < 0)
+      return -1;
+  return 0;
+}
+
 // Fetch the int at addr from the current process.
 int
 fetchint(uint addr, int *ip)
 {
+  uint end;
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if((end = uvmend(curproc, addr)) == 0 || addr+4 > end)
+    return -1;
+  if(fetchpages(addr, 4) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -34,11 +54,12 @@ fetchstr(uint addr, char **pp)
   char *s, *ep;
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz)
+  if((ep = (char*)uvmend(curproc, addr)) == 0)
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && fetchpages((uint)s, 1) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -59,16 +80,31 @@ int
 argptr(int n, char **pp, int size)
 {
   int i;
+  uint end;
   struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || (end = uvmend(curproc, i)) == 0 || (uint)i+size > end)
+    return -1;
+  if(fetchpages(i, size) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Check that the kernel may store size bytes at p, which
+// argptr() accepted.  Read-only mmap() pages would fault.
+int
+argwritable(char *p, int size)
+{
+  struct vma *v;
+
+  if((v = findvma(myproc(), (uint)p)) != 0 && !(v->prot & PROT_WRITE))
+    return -1;
+  return 0;
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -106,6 +142,9 @@ extern int sys_uptime(void);
 extern int sys_slink(void);
 extern int sys_sync(void);
 extern int sys_openinfo(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_iostat(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]      sys_fork,
@@ -132,6 +171,9 @@ static int (*syscalls[])(void) = {
 [SYS_slink]     sys_slink,
 [SYS_sync]      sys_sync,
 [SYS_openinfo]  sys_openinfo,
+[SYS_mmap]      sys_mmap,
+[SYS_munmap]    sys_munmap,
+[SYS_iostat]    sys_iostat,
 };
 
 void
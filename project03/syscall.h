@@ -22,4 +22,7 @@
 #define SYS_close      21
 #define SYS_slink      22
 #define SYS_sync       23
-#define SYS_openinfo   24
\ No newline at end of file
+#define SYS_openinfo   24
+#define SYS_mmap       25
+#define SYS_munmap     26
+#define SYS_iostat     27
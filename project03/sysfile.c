@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "iostat.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -73,7 +74,8 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argwritable(p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -109,7 +111,8 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0 ||
+     argwritable((char*)st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
@@ -171,7 +174,8 @@ sys_slink(void)
   char name[DIRSIZ], *new, *old;
   struct inode *dp, *ip, *nip;
 
-  if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
+  // sys_open() reads the target back into a MAXPATH buffer.
+  if(argstr(0, &old) < 0 || argstr(1, &new) < 0 || strlen(old) >= MAXPATH)
     return -1;
 
   begin_op();
@@ -341,7 +345,7 @@ create(char *path, short type, short major, short minor)
 int
 sys_open(void)
 {
-  char *path, npath[BSIZE];
+  char *path, npath[MAXPATH];
   int fd, omode, bytes;
   struct file *f;
   struct inode *ip;
@@ -367,7 +371,7 @@ sys_open(void)
     // Symbolic link: redirect to indicated file.
     if(ip->type == T_SYM){
       // Read the original file path.
-      if((bytes = readi(ip, npath, 0, BSIZE - 1)) < 0){
+      if((bytes = readi(ip, npath, 0, MAXPATH - 1)) < 0){
         iunlockput(ip);
         end_op();
         return -1;
@@ -553,7 +557,8 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0 ||
+     argwritable((char*)fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
@@ -574,4 +579,42 @@ int
 sys_sync(void)
 {
   return sync();
-}
\ No newline at end of file
+}
+
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int addr, len, prot, flags, off;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argfd(4, 0, &f) < 0 || argint(5, &off) < 0)
+    return -1;
+  // The kernel picks the address.
+  if(addr != 0 || off < 0)
+    return -1;
+  return mmap(f, off, len, prot, flags);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+int
+sys_iostat(void)
+{
+  struct iostat *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0 ||
+     argwritable((char*)st, sizeof(*st)) < 0)
+    return -1;
+  bstat(st);
+  idestats(st);
+  return 0;
+}
@@ -78,6 +78,11 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // First touch of a page of an mmap() region.
+    if(myproc() && !(tf->err & FEC_PR) && mmapfault(myproc(), rcr2()) == 0)
+      break;
+    // Otherwise it is an ordinary bad access; fall through.
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -1,4 +1,5 @@
 struct stat;
+struct iostat;
 struct rtcdate;
 
 // system calls
@@ -26,6 +27,9 @@ int sleep(int);
 int uptime(void);
 int sync(void);
 int openinfo(const char*, int);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int iostat(struct iostat*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -0,0 +1,393 @@
+// virtio-blk driver, for the legacy (virtio 0.9.5) PCI device
+// that QEMU gives with -device virtio-blk-pci,disable-modern=on.
+// Every buf is its own request, and as many are in flight at
+// once as the queue has room for; the device may finish them in
+// any order.  Built instead of ide.c with `make DISK=virtio`, and
+// like ide.c provides ideinit, idesubmit, ideintr and the rest.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "iostat.h"
+#include "pci.h"
+
+#define SECTOR_SIZE   512
+
+// Legacy virtio PCI registers, from iobase.
+#define VIRTIO_HOSTFEAT   0x00  // features the device offers
+#define VIRTIO_GUESTFEAT  0x04  // features the driver takes
+#define VIRTIO_QADDR      0x08  // page number of the selected queue
+#define VIRTIO_QSIZE      0x0c  // entries in the selected queue
+#define VIRTIO_QSEL       0x0e  // select a queue
+#define VIRTIO_QNOTIFY    0x10  // tell the device a queue has work
+#define VIRTIO_STATUS     0x12  // device status
+#define VIRTIO_ISR        0x13  // interrupt status; reading clears it
+#define VIRTIO_CONFIG     0x14  // device configuration
+
+#define VIRTIO_ACK        1     // VIRTIO_STATUS: driver found the device
+#define VIRTIO_DRIVER     2     // and knows how to drive it
+#define VIRTIO_DRIVER_OK  4     // and is ready
+
+#define VIRTIO_VENDOR     0x1af4
+#define VIRTIO_BLKDEV     0x1001  // legacy block device
+
+// Virtqueue descriptor: a piece of a request in memory.
+struct vdesc {
+  uint addr;
+  uint addrhi;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+#define VDESC_NEXT        1     // next is valid
+#define VDESC_WRITE       2     // the device writes this piece
+
+// The ring of requests the driver offers the device.
+struct vavail {
+  ushort flags;
+  ushort idx;       // where the driver puts the next entry
+  ushort ring[];
+};
+
+// The ring of requests the device has finished.
+struct vused {
+  ushort flags;
+  ushort idx;       // where the device puts the next entry
+  struct {
+    uint id;        // first descriptor of the request
+    uint len;
+  } ring[];
+};
+
+// Request header, followed by the data and a status byte.
+struct vblkreq {
+  uint type;
+  uint reserved;
+  uint sector;
+  uint sectorhi;
+};
+#define VIRTIO_BLK_IN     0     // read
+#define VIRTIO_BLK_OUT    1     // write
+
+// Descriptors the driver can handle; the device decides how
+// many there are.  Each request takes three.
+#define NVDESC 256
+
+// The legacy layout puts the descriptors, then the available
+// ring, then on the next page the used ring, in memory the
+// device reads by physical address.
+#define VQALIGN(x) (((x) + PGSIZE - 1) & ~(PGSIZE - 1))
+#define VQSIZE(n)  (VQALIGN(16*(n) + 2*(3 + (n))) + VQALIGN(2*3 + 8*(n)))
+
+static char vqmem[VQSIZE(NVDESC)] __attribute__((aligned(PGSIZE)));
+
+static struct spinlock idelock;
+static ushort iobase;
+static int nvdesc;              // descriptors in the queue
+static struct vdesc *desc;
+static struct vavail *avail;
+static struct vused *used;
+static ushort usedidx;          // next used entry to look at
+
+static uchar descfree[NVDESC];  // descriptor is not in use
+static int ndescfree;
+
+// The request each head descriptor starts.
+static struct {
+  struct buf *b;
+  struct vblkreq hdr;
+  uchar status;
+} info[NVDESC];
+
+// bufs waiting for descriptors, first come first served.
+static struct buf *idequeue;
+
+static struct {
+  uint reqs;          // bufs done
+  uint depth;         // sum of requests in flight seen by new ones
+  uint inflight;      // requests now given to the device
+  uint wait;          // sum of ticks from request to done
+  uint intrs;         // disk interrupts
+  uint kcycles;       // 1024s of cycles spent in the driver
+  uint cycles;        // and the rest
+} idestat;
+
+// Count the cycles since t0 as spent in the driver.
+// Caller must hold idelock.
+static void
+idecycles(uint t0)
+{
+  idestat.cycles += rdtsc() - t0;
+  idestat.kcycles += idestat.cycles >> 10;
+  idestat.cycles &= 1023;
+}
+
+void
+ideinit(void)
+{
+  struct pcidev *d;
+  uint sz;
+
+  initlock(&idelock, "ide");
+  for(d = pcinext(0); d; d = pcinext(d))
+    if(d->vendor == VIRTIO_VENDOR && d->device == VIRTIO_BLKDEV)
+      break;
+  if(d == 0 || !(d->bar[0] & PCI_BAR_IO))
+    panic("ideinit: no virtio-blk device");
+  iobase = d->bar[0] & PCI_BAR_IOMASK;
+  pcienable(d);
+
+  // Reset, say hello, and take none of the optional features.
+  outb(iobase+VIRTIO_STATUS, 0);
+  outb(iobase+VIRTIO_STATUS, VIRTIO_ACK);
+  outb(iobase+VIRTIO_STATUS, VIRTIO_ACK|VIRTIO_DRIVER);
+  outl(iobase+VIRTIO_GUESTFEAT, 0);
+
+  // Lay out queue 0 in vqmem.
+  outw(iobase+VIRTIO_QSEL, 0);
+  nvdesc = inw(iobase+VIRTIO_QSIZE);
+  if(nvdesc == 0 || nvdesc > NVDESC)
+    panic("ideinit: virtio queue size");
+  sz = VQSIZE(nvdesc);
+  memset(vqmem, 0, sz);
+  desc = (struct vdesc*)vqmem;
+  avail = (struct vavail*)(vqmem + 16*nvdesc);
+  used = (struct vused*)(vqmem + VQALIGN(16*nvdesc + 2*(3 + nvdesc)));
+  for(ndescfree = 0; ndescfree < nvdesc; ndescfree++)
+    descfree[ndescfree] = 1;
+  outl(iobase+VIRTIO_QADDR, V2P(vqmem) >> 12);
+
+  outb(iobase+VIRTIO_STATUS, VIRTIO_ACK|VIRTIO_DRIVER|VIRTIO_DRIVER_OK);
+
+  // Its interrupts come in as the disk's, to ideintr().
+  ioapicroute(d->irq, T_IRQ0 + IRQ_IDE, ncpu - 1);
+  cprintf("virtio-blk: port 0x%x irq %d, %d descriptors\n",
+          iobase, d->irq, nvdesc);
+}
+
+// Take a free descriptor.  Caller must hold idelock and know
+// that there is one.
+static int
+descalloc(void)
+{
+  int i;
+
+  for(i = 0; i < nvdesc; i++){
+    if(descfree[i]){
+      descfree[i] = 0;
+      ndescfree--;
+      return i;
+    }
+  }
+  panic("descalloc");
+}
+
+// Free the chain of descriptors from i.
+// Caller must hold idelock.
+static void
+descfreechain(int i)
+{
+  for(;;){
+    descfree[i] = 1;
+    ndescfree++;
+    if(!(desc[i].flags & VDESC_NEXT))
+      break;
+    i = desc[i].next;
+  }
+}
+
+// Give the device the request for b.
+// Caller must hold idelock, and three descriptors must be free.
+static void
+idestart(struct buf *b)
+{
+  int d[3], i;
+
+  if(b->blockno >= FSSIZE)
+    panic("incorrect blockno");
+  for(i = 0; i < 3; i++)
+    d[i] = descalloc();
+
+  info[d[0]].b = b;
+  info[d[0]].hdr.type = (b->flags & B_DIRTY) ? VIRTIO_BLK_OUT : VIRTIO_BLK_IN;
+  info[d[0]].hdr.reserved = 0;
+  info[d[0]].hdr.sector = b->blockno * (BSIZE/SECTOR_SIZE);
+  info[d[0]].hdr.sectorhi = 0;
+  info[d[0]].status = 0xff;
+
+  desc[d[0]].addr = V2P(&info[d[0]].hdr);
+  desc[d[0]].len = sizeof(struct vblkreq);
+  desc[d[0]].flags = VDESC_NEXT;
+  desc[d[0]].next = d[1];
+
+  desc[d[1]].addr = V2P(b->data);
+  desc[d[1]].len = BSIZE;
+  desc[d[1]].flags = VDESC_NEXT | ((b->flags & B_DIRTY) ? 0 : VDESC_WRITE);
+  desc[d[1]].next = d[2];
+
+  desc[d[2]].addr = V2P(&info[d[0]].status);
+  desc[d[2]].len = 1;
+  desc[d[2]].flags = VDESC_WRITE;
+  desc[d[2]].next = 0;
+
+  for(i = 0; i < 3; i++)
+    desc[d[i]].addrhi = 0;
+
+  avail->ring[avail->idx % nvdesc] = d[0];
+  __sync_synchronize();  // the device must see the ring entry first
+  avail->idx++;
+  __sync_synchronize();
+  outw(iobase+VIRTIO_QNOTIFY, 0);
+  idestat.inflight++;
+}
+
+// Give the device the waiting bufs that there are descriptors for.
+// Caller must hold idelock.
+static void
+idestartwaiting(void)
+{
+  struct buf *b;
+
+  while(idequeue && ndescfree >= 3){
+    b = idequeue;
+    idequeue = b->qnext;
+    idestart(b);
+  }
+}
+
+// Interrupt handler: the device has finished some requests.
+// Take them off the used ring one at a time, and call each one's
+// done function without idelock held.
+void
+ideintr(void)
+{
+  struct buf *b;
+  void (*done)(struct buf*);
+  int id;
+  uint t0;
+
+  t0 = rdtsc();
+  acquire(&idelock);
+  idestat.intrs++;
+  // Reading the ISR lowers the interrupt; requests finished
+  // after this interrupt again.
+  inb(iobase+VIRTIO_ISR);
+
+  for(;;){
+    __sync_synchronize();
+    if(usedidx == used->idx)
+      break;
+    id = used->ring[usedidx % nvdesc].id;
+    usedidx++;
+
+    b = info[id].b;
+    if(info[id].status != 0)
+      panic("ideintr: virtio-blk request failed");
+    info[id].b = 0;
+    descfreechain(id);
+    idestat.inflight--;
+    idestat.reqs++;
+    idestat.wait += ticks - b->qtime;
+
+    // Wake process waiting for this buf.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+    done = b->done;
+    b->done = 0;
+
+    idestartwaiting();
+    if(done){
+      release(&idelock);
+      done(b);
+      acquire(&idelock);
+    }
+  }
+
+  idecycles(t0);
+  release(&idelock);
+}
+
+//PAGEBREAK!
+// Queue buf for the disk and return without waiting.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// When the request is done, ideintr() wakes up idewaitrw() and
+// then calls done, if not 0, which may release buf.
+void
+idesubmit(struct buf *b, void (*done)(struct buf*))
+{
+  struct buf **pp;
+  uint t0;
+
+  if(!holdingsleep(&b->lock))
+    panic("idesubmit: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("idesubmit: nothing to do");
+  if(b->dev != ROOTDEV)
+    panic("idesubmit: no such disk");
+
+  t0 = rdtsc();
+  acquire(&idelock);
+
+  b->done = done;
+  b->qtime = ticks;
+  idestat.depth += idestat.inflight + 1;
+
+  // Wait for descriptors behind the bufs already waiting.
+  b->qnext = 0;
+  for(pp = &idequeue; *pp; pp = &(*pp)->qnext)
+    ;
+  *pp = b;
+  idestartwaiting();
+
+  idecycles(t0);
+  release(&idelock);
+}
+
+// Wait for the request for buf to finish.
+void
+idewaitrw(struct buf *b)
+{
+  acquire(&idelock);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+    sleep(b, &idelock);
+  }
+  release(&idelock);
+}
+
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  idesubmit(b, 0);
+  idewaitrw(b);
+}
+
+// Copy the disk queue counters to st.  Each request is its own
+// command, and is moved by the device, not the cpu.
+void
+idestats(struct iostat *st)
+{
+  acquire(&idelock);
+  st->ioreqs = idestat.reqs;
+  st->iocmds = idestat.reqs;
+  st->iodepth = idestat.depth;
+  st->iowait = idestat.wait;
+  st->ioexpired = 0;
+  st->iodma = 1;
+  st->iointrs = idestat.intrs;
+  st->iokcycles = idestat.kcycles;
+  release(&idelock);
+}
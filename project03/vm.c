@@ -6,6 +6,11 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
@@ -313,12 +318,13 @@ clearpteu(pde_t *pgdir, char *uva)
 // Given a parent process's page table, create a copy
 // of it for a child.
 pde_t*
-copyuvm(pde_t *pgdir, uint sz)
+copyuvm(pde_t *pgdir, uint sz, struct vma *vma)
 {
   pde_t *d;
   pte_t *pte;
   uint pa, i, flags;
   char *mem;
+  struct vma *v;
 
   if((d = setupkvm()) == 0)
     return 0;
@@ -337,6 +343,25 @@ copyuvm(pde_t *pgdir, uint sz)
       goto bad;
     }
   }
+  // Copy the mmap() pages that have been filled; the
+  // child reads the others from the file itself.
+  for(v = vma; v < &vma[NVMA]; v++){
+    if(v->end == 0)
+      continue;
+    for(i = v->start; i < v->end; i += PGSIZE){
+      if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & PTE_P))
+        continue;
+      pa = PTE_ADDR(*pte);
+      flags = PTE_FLAGS(*pte);
+      if((mem = kalloc()) == 0)
+        goto bad;
+      memmove(mem, (char*)P2V(pa), PGSIZE);
+      if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
+        kfree(mem);
+        goto bad;
+      }
+    }
+  }
   return d;
 
 bad:
@@ -344,6 +369,77 @@ bad:
   return 0;
 }
 
+// Return the mmap() region of p holding va, or 0.
+struct vma*
+findvma(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end && v->start <= va && va < v->end)
+      return v;
+  return 0;
+}
+
+// Return the end of the part of p's address space that holds
+// va: sz for the program and heap, or the end of an mmap()
+// region.  Returns 0 if va is not a user address of p.
+uint
+uvmend(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  if(va < p->sz)
+    return p->sz;
+  if((v = findvma(p, va)) != 0)
+    return v->end;
+  return 0;
+}
+
+// Fill the page at va of an mmap() region of p from its file.
+// The data comes through readi() and so the buffer cache; bytes
+// past the end of the file read as zero.  Returns 0 if va is now
+// mapped, -1 if va is not in a region or memory is exhausted.
+int
+mmapfault(struct proc *p, uint va)
+{
+  struct vma *v;
+  struct inode *ip;
+  pte_t *pte;
+  char *mem;
+  uint off;
+  int perm;
+
+  if((v = findvma(p, va)) == 0)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pte = walkpgdir(p->pgdir, (void*)va, 0);
+  if(pte && (*pte & PTE_P))
+    return 0;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  ip = v->f->ip;
+  off = v->off + (va - v->start);
+  ilock(ip);
+  if(off < ip->size && readi(ip, mem, off, PGSIZE) < 0){
+    iunlock(ip);
+    kfree(mem);
+    return -1;
+  }
+  iunlock(ip);
+
+  perm = PTE_U;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*